@@ -0,0 +1,234 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: AsyncFrameSource.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// User libraries
+#include "AsyncFrameSource.hpp"
+
+namespace {
+
+// Spin a few times before sleeping, frames take milliseconds to decode
+void backOff(int& spins)
+{
+    if (++spins < 64)
+    {
+        std::this_thread::yield();
+    }
+    else
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+} // namespace
+
+
+// Constructor: the decoder thread starts on the first read, such that seeks go straight to the source
+AsyncFrameSource::AsyncFrameSource(std::unique_ptr<FrameSource> source, int numFramesAhead) : m_source(std::move(source)), m_ring(std::max(1, numFramesAhead) + 1), m_head(0), m_tail(0), m_endOfStream(false), m_stop(false), m_position(m_source->position()), m_frameCount(m_source->frameCount()), m_frameRate(m_source->frameRate()), m_framesDecoded(0), m_decoderStalls(0)
+{
+    m_consumerStats = DecodeAheadStats();
+}
+
+
+// Destructor
+AsyncFrameSource::~AsyncFrameSource()
+{
+    stop();
+}
+
+
+// Read the next decoded frame, waits if the decoder is behind
+bool AsyncFrameSource::read(cv::Mat& frame)
+{
+    if (!m_decoder.joinable())
+    {
+        start();
+    }
+
+    size_t head = m_head.load(std::memory_order_relaxed);
+    int spins = 0;
+    bool stalled = false;
+    while (head == m_tail.load(std::memory_order_acquire))
+    {
+        // The end flag is set after the last frame got queued
+        if (m_endOfStream.load(std::memory_order_acquire) && head == m_tail.load(std::memory_order_acquire))
+        {
+            // A failed decode ends the stream like the end of the video, the consumer gets its exception
+            if (m_error)
+            {
+                std::exception_ptr error = m_error;
+                m_error = std::exception_ptr();
+                std::rethrow_exception(error);
+            }
+            return false;
+        }
+        stalled = true;
+        backOff(spins);
+    }
+
+    if (stalled)
+    {
+        ++m_consumerStats.consumerStalls;
+    }
+    int depth = queueDepth();
+    m_consumerStats.queueDepthSum += depth;
+    m_consumerStats.maxQueueDepth = std::max(m_consumerStats.maxQueueDepth, depth);
+    ++m_consumerStats.framesRead;
+
+    // Take ownership of the frame, the decoder must not decode into memory still in use
+    frame = m_ring[head];
+    m_ring[head] = cv::Mat();
+    m_head.store((head + 1) % m_ring.size(), std::memory_order_release);
+
+    ++m_position;
+    return true;
+}
+
+
+// Position the source, decoded frames are dropped
+bool AsyncFrameSource::seek(int pos)
+{
+    stop();
+    if (!m_source->seek(pos))
+    {
+        return false;
+    }
+    m_position = pos;
+    return true;
+}
+
+
+// Return index of the next frame handed out
+int AsyncFrameSource::position() const
+{
+    return m_position;
+}
+
+
+// Return number of frames of the video
+int AsyncFrameSource::frameCount() const
+{
+    return m_frameCount;
+}
+
+
+// Return frames per second of the video
+double AsyncFrameSource::frameRate() const
+{
+    return m_frameRate;
+}
+
+
+// Return number of decoded frames waiting in the queue
+int AsyncFrameSource::queueDepth() const
+{
+    size_t head = m_head.load(std::memory_order_acquire);
+    size_t tail = m_tail.load(std::memory_order_acquire);
+    return (tail + m_ring.size() - head) % m_ring.size();
+}
+
+
+// Return decode-ahead statistics
+DecodeAheadStats AsyncFrameSource::stats() const
+{
+    DecodeAheadStats stats = m_consumerStats;
+    stats.framesDecoded = m_framesDecoded.load();
+    stats.decoderStalls = m_decoderStalls.load();
+    return stats;
+}
+
+
+// Print decode-ahead statistics
+void AsyncFrameSource::printStats() const
+{
+    DecodeAheadStats s = stats();
+    double meanDepth = s.framesRead > 0 ? (double) s.queueDepthSum / s.framesRead : 0.0;
+    std::cout << "decode-ahead: " << s.framesDecoded << " frames decoded, " << s.framesRead << " read, "
+              << "decoder stalls (queue full): " << s.decoderStalls << ", consumer stalls (queue empty): " << s.consumerStalls
+              << ", queue depth mean: " << meanDepth << " max: " << s.maxQueueDepth << " of " << m_ring.size() - 1 << std::endl;
+}
+
+
+// Start the decoder thread
+void AsyncFrameSource::start()
+{
+    m_stop.store(false);
+    m_endOfStream.store(false);
+    m_error = std::exception_ptr();
+    m_decoder = std::thread(&AsyncFrameSource::decodeLoop, this);
+}
+
+
+// Stop the decoder thread and drop all queued frames
+void AsyncFrameSource::stop()
+{
+    if (m_decoder.joinable())
+    {
+        m_stop.store(true);
+        m_decoder.join();
+    }
+
+    for (size_t i = 0; i < m_ring.size(); ++i)
+    {
+        m_ring[i].release();
+    }
+    m_head.store(0);
+    m_tail.store(0);
+}
+
+
+// Decoder thread: decode into the free slots until the queue is full
+void AsyncFrameSource::decodeLoop()
+{
+    while (!m_stop.load(std::memory_order_relaxed))
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % m_ring.size();
+
+        // Back-pressure: wait for the consumer to free a slot
+        int spins = 0;
+        bool stalled = false;
+        while (next == m_head.load(std::memory_order_acquire))
+        {
+            if (m_stop.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+            stalled = true;
+            backOff(spins);
+        }
+        if (stalled)
+        {
+            ++m_decoderStalls;
+        }
+
+        // An exception must not leave the thread, it would terminate the process
+        bool decoded = false;
+        try
+        {
+            decoded = m_source->read(m_ring[tail]);
+        }
+        catch (...)
+        {
+            m_error = std::current_exception();
+        }
+
+        if (!decoded)
+        {
+            m_endOfStream.store(true, std::memory_order_release);
+            return;
+        }
+        ++m_framesDecoded;
+
+        m_tail.store(next, std::memory_order_release);
+    }
+}
@@ -0,0 +1,115 @@
+/**************************************
+ * Header file: AsyncFrameSource.hpp
+ *
+ * Decodes frames of another frame source
+ * on a dedicated thread ahead of the
+ * consumer
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_ASYNCFRAMESOURCE_HPP
+#define VIDEOSTAB_ASYNCFRAMESOURCE_HPP
+
+// C++ std libraries
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// User libraries
+#include "FrameSource.hpp"
+
+// Decode-ahead statistics
+struct DecodeAheadStats {
+    long framesDecoded; // frames decoded by the decoder thread
+    long framesRead; // frames handed out to the consumer
+    long decoderStalls; // back-pressure: decoder waited on a full queue
+    long consumerStalls; // consumer waited on an empty queue
+    long queueDepthSum; // sum of the queue depth seen by the consumer on every read
+    int maxQueueDepth; // maximum queue depth seen by the consumer
+};
+
+class AsyncFrameSource : public FrameSource
+{
+
+    public:
+
+        // Constructor takes ownership of the decoding source and the number of frames to decode ahead
+        AsyncFrameSource(std::unique_ptr<FrameSource>, int);
+
+        // Destructor stops the decoder thread
+        virtual ~AsyncFrameSource();
+
+        // Read the next decoded frame, an exception of the decoder thread is rethrown once the frames before it are read
+        virtual bool read(cv::Mat&);
+
+        // Seeking stops the decoder thread and drops all decoded frames
+        virtual bool seek(int);
+
+        virtual int position() const;
+
+        virtual int frameCount() const;
+
+        virtual double frameRate() const;
+
+        // Print decode-ahead statistics
+        virtual void printStats() const;
+
+        // Return decode-ahead statistics
+        DecodeAheadStats stats() const;
+
+        // Return number of decoded frames waiting in the queue
+        int queueDepth() const;
+
+    private:
+
+        // Start the decoder thread
+        void start();
+
+        // Stop the decoder thread and clear the queue
+        void stop();
+
+        // Decoder thread main loop
+        void decodeLoop();
+
+        // Decoding frame source, only touched by the decoder thread while it runs
+        std::unique_ptr<FrameSource> m_source;
+
+        // Single producer single consumer ring buffer, one slot stays empty
+        std::vector<cv::Mat> m_ring;
+
+        // Next slot to read (consumer)
+        std::atomic<size_t> m_head;
+
+        // Next slot to write (producer)
+        std::atomic<size_t> m_tail;
+
+        // Set by the decoder at the end of the video
+        std::atomic<bool> m_endOfStream;
+
+        // Set to stop the decoder thread
+        std::atomic<bool> m_stop;
+
+        // Exception thrown by the decoding source, published by m_endOfStream
+        std::exception_ptr m_error;
+
+        // Decoder thread
+        std::thread m_decoder;
+
+        // Index of the next frame handed out to the consumer
+        int m_position;
+
+        // Number of frames of the video
+        int m_frameCount;
+
+        // Frames per second of the video
+        double m_frameRate;
+
+        // Statistics, decoder side counters are atomic
+        std::atomic<long> m_framesDecoded;
+        std::atomic<long> m_decoderStalls;
+        DecodeAheadStats m_consumerStats;
+};
+
+#endif // VIDEOSTAB_ASYNCFRAMESOURCE_HPP
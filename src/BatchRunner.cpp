@@ -0,0 +1,168 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: BatchRunner.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+// OpenCV libraries
+#include <opencv2/core/core.hpp>
+
+// User libraries
+#include "BatchRunner.hpp"
+#include "ThreadPool.hpp"
+#include "VideoProcessing.hpp"
+#include "file_utils.h"
+
+// Constructor
+BatchRunner::BatchRunner(const VideoProcessingParams& defaults, int numWorkers) : m_defaults(defaults), m_numWorkers(numWorkers)
+{
+    if (m_numWorkers <= 0)
+    {
+        m_numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+
+// Process all jobs of the manifest on one shared pool
+// Every job writes to its own output directory <outputDir>/<name>/
+int BatchRunner::run(const std::string& manifestPath)
+{
+    if (!parseManifest(manifestPath))
+    {
+        return -1;
+    }
+
+    // Split the hardware threads between the concurrent jobs, such that
+    // OpenCV's internal parallelism does not oversubscribe the machine
+    int numHwThreads = std::max(1u, std::thread::hardware_concurrency());
+    int numWorkers = std::min<int>(m_numWorkers, m_jobs.size());
+    int threadsPerJob = std::max(1, numHwThreads / std::max(1, numWorkers));
+    cv::setNumThreads(threadsPerJob);
+
+    // One pool runs the jobs and all of their stages, sized by --warp_threads of the defaults
+    m_pool.reset(new ThreadPool(m_defaults.warpThreads));
+
+    std::cout << "batch of " << m_jobs.size() << " jobs on " << numWorkers << " workers, " << m_pool->numThreads() << " threads" << std::endl;
+
+    // Every worker runs its jobs on one session, so buffers are reused from clip to clip
+    for (int w = 0; w < numWorkers; ++w)
+    {
+        m_sessions.push_back(std::unique_ptr<VideoProcessing>(new VideoProcessing(m_jobs[w].params, m_pool.get())));
+    }
+
+    // A worker takes the next job once its clip is done, a job waiting for its stages runs their tasks meanwhile
+    std::atomic<int> nextJob(0);
+    TaskGroup workers;
+    for (int w = 0; w < numWorkers; ++w)
+    {
+        VideoProcessing* session = m_sessions[w].get();
+        m_pool->submit(workers, [this, session, &nextJob]()
+        {
+            for (int i = nextJob++; i < m_jobs.size(); i = nextJob++)
+            {
+                runJob(m_jobs[i], *session);
+            }
+        }, w);
+    }
+    m_pool->wait(workers);
+    m_pool->printStats("whole batch");
+
+    // Summary
+    int numFailed = 0;
+    for (int i = 0; i < m_jobs.size(); ++i)
+    {
+        std::cout << (m_jobs[i].succeeded ? "done   " : "FAILED ") << m_jobs[i].name << " (" << m_jobs[i].seconds << " seconds)" << std::endl;
+        if (!m_jobs[i].succeeded)
+        {
+            ++numFailed;
+        }
+    }
+
+    std::cout << "batch done: " << m_jobs.size() - numFailed << " of " << m_jobs.size() << " jobs succeeded" << std::endl;
+
+    return numFailed;
+}
+
+
+// Parse manifest file
+// One job per line: <input> [key=value ...], empty lines and lines starting with '#' are skipped
+bool BatchRunner::parseManifest(const std::string& manifestPath)
+{
+    std::ifstream manifest(manifestPath.c_str());
+    if (!manifest.is_open())
+    {
+        std::cout << "Cannot open the manifest " << manifestPath << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(manifest, line))
+    {
+        ++lineNumber;
+
+        std::istringstream tokens(line);
+        std::string token;
+        if (!(tokens >> token) || token[0] == '#')
+        {
+            continue;
+        }
+
+        BatchJob job;
+        job.filePath = token;
+        job.params = m_defaults;
+        job.succeeded = false;
+        job.seconds = 0.0;
+
+        while (tokens >> token)
+        {
+            if (!parseVideoProcessingParam(token, job.params))
+            {
+                std::cout << "manifest line " << lineNumber << " rejected" << std::endl;
+                return false;
+            }
+        }
+
+        // Isolated output directory per job, the line number keeps names of equal clips unique
+        std::ostringstream name;
+        name << base::FileUtils::BaseName(job.filePath) << "_" << lineNumber;
+        job.name = name.str();
+        job.params.outputDir += job.name + "/";
+
+        m_jobs.push_back(job);
+    }
+
+    return true;
+}
+
+
+// Process a single job, errors are reported and do not stop the batch
+void BatchRunner::runJob(BatchJob& job, VideoProcessing& session)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    try
+    {
+        session.configure(job.params);
+        session.process(job.filePath, base::FileUtils::BaseName(job.filePath));
+        job.succeeded = true;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "job " << job.name << " failed: " << e.what() << std::endl;
+    }
+
+    job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
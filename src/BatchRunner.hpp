@@ -0,0 +1,66 @@
+/**************************************
+ * Header file: BatchRunner.hpp
+ *
+ * Processes the clips of a manifest
+ * concurrently on a shared worker pool
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_BATCHRUNNER_HPP
+#define VIDEOSTAB_BATCHRUNNER_HPP
+
+// C++ std libraries
+#include <memory>
+#include <string>
+#include <vector>
+
+// User libraries
+#include "ThreadPool.hpp"
+#include "VideoProcessing.hpp"
+#include "VideoProcessingParams.hpp"
+
+// A single clip of the manifest
+struct BatchJob {
+    std::string filePath; // input clip
+    std::string name; // output name, unique within the batch
+    VideoProcessingParams params; // settings of this clip
+    bool succeeded; // set when the job finished without error
+    double seconds; // processing time
+};
+
+class BatchRunner
+{
+
+    public:
+
+        // Constructor takes the default settings of all jobs and the number of concurrent jobs (0: hardware threads)
+        BatchRunner(const VideoProcessingParams&, int = 0);
+
+        // Parse manifest and process all jobs, return number of failed jobs
+        int run(const std::string&);
+
+    private:
+
+        // Parse manifest file into jobs
+        bool parseManifest(const std::string&);
+
+        // Process a single job on a session
+        void runJob(BatchJob&, VideoProcessing&);
+
+        // Default settings
+        VideoProcessingParams m_defaults;
+
+        // Number of concurrently processed jobs
+        int m_numWorkers;
+
+        // All jobs of the manifest
+        std::vector<BatchJob> m_jobs;
+
+        // Pool shared by the jobs and all of their stages
+        std::unique_ptr<ThreadPool> m_pool;
+
+        // One processing session per worker, kept for all jobs the worker runs
+        std::vector<std::unique_ptr<VideoProcessing> > m_sessions;
+};
+
+#endif // VIDEOSTAB_BATCHRUNNER_HPP
@@ -0,0 +1,200 @@
+/**************************************
+ * Header file: BilinearSampler.hpp
+ *
+ * Fixed point bilinear interpolation
+ * of 8-bit and 16-bit 3-channel images,
+ * per pixel or per row (SSE2)
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_BILINEARSAMPLER_HPP
+#define VIDEOSTAB_BILINEARSAMPLER_HPP
+
+// C++ std libraries
+#include <algorithm>
+#include <cmath>
+
+// OpenCV libraries
+#include <opencv2/core/core.hpp>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Border the sampled image needs around it: rows and columns before (top, left) and after (bottom, right)
+const int kSamplerBorderBefore = 1;
+const int kSamplerBorderAfter = 2;
+
+// Bilinear sampler reading CV_8UC3 (T = unsigned char) or CV_16UC3 (T = unsigned short) data directly
+// The four tap weights are integers with FracBits fractional bits that always sum up to 1 << FracBits,
+// so a sample is a 32-bit integer dot product of the taps with the weights
+// The image has to be a view into a buffer with a zero border of kSamplerBorderBefore / kSamplerBorderAfter
+// pixels (see VideoFrame), positions are clamped onto the border, so the sampler never branches on bounds.
+// Taps outside the image read zeros, the weight of the taps inside is returned as coverage of the sample.
+template<typename T, int FracBits>
+class BilinearSampler
+{
+    static_assert(FracBits >= 7 && FracBits <= 15, "weights need 7 to 15 fractional bits to fit 32-bit sums of 16-bit taps");
+
+    public:
+
+        // Weight of a full pixel
+        static const int kOne = 1 << FracBits;
+
+        // Construct a sampler on the image data, the image stays owned by the caller
+        explicit BilinearSampler(const cv::Mat& src) : m_src(src)
+        {
+        }
+
+        // Sample at (x,y) in image coordinates
+        // @acc: per channel sample scaled by kOne
+        // @return: weight of the taps inside the image (coverage), kOne if the sample lies fully inside
+        int sample(float x, float y, int acc[3]) const
+        {
+            // Far out positions end up on the border with all weight on a border tap, NaN ends up outside the image
+            if (!(x == x))
+            {
+                x = -1.0f;
+            }
+            if (!(y == y))
+            {
+                y = -1.0f;
+            }
+            x = std::min(std::max(x, -1.0f), (float) m_src.cols);
+            y = std::min(std::max(y, -1.0f), (float) m_src.rows);
+
+            float fx0 = std::floor(x);
+            float fy0 = std::floor(y);
+            int ix = (int) fx0;
+            int iy = (int) fy0;
+
+            // Fixed point weights of the right and lower taps
+            int wx = (int) ((x - fx0) * kOne + 0.5f);
+            int wy = (int) ((y - fy0) * kOne + 0.5f);
+
+            // Tap weights (upper-left, upper-right, lower-left, lower-right) summing up to kOne
+            int w[4];
+            w[3] = (wx * wy + (kOne >> 1)) >> FracBits;
+            w[1] = wx - w[3];
+            w[2] = wy - w[3];
+            w[0] = kOne - w[1] - w[2] - w[3];
+
+            taps(ix, iy, w, acc);
+
+            // Validity of the tap columns and rows, comparisons instead of branches
+            int inX0 = (unsigned) ix < (unsigned) m_src.cols;
+            int inX1 = (unsigned) (ix + 1) < (unsigned) m_src.cols;
+            int inY0 = (unsigned) iy < (unsigned) m_src.rows;
+            int inY1 = (unsigned) (iy + 1) < (unsigned) m_src.rows;
+            return w[0] * (inX0 & inY0) + w[1] * (inX1 & inY0) + w[2] * (inX0 & inY1) + w[3] * (inX1 & inY1);
+        }
+
+        // Sample a row of n positions, the same arithmetic as n calls of sample()
+        // With SSE2 the positions are clamped and the tap weights and coverages computed for four pixels at a time,
+        // only the taps are read pixel by pixel
+        // @acc:      3 n per channel samples scaled by kOne
+        // @coverage: n coverages, kOne if a sample lies fully inside
+        void sampleRow(const float* xs, const float* ys, int n, int* acc, int* coverage) const
+        {
+            int j = 0;
+#if defined(__SSE2__)
+            // Products of two weights are exact in float up to 12 fractional bits
+            if (FracBits <= 12)
+            {
+                const __m128 minusOne = _mm_set1_ps(-1.0f);
+                const __m128 maxX = _mm_set1_ps((float) m_src.cols);
+                const __m128 maxY = _mm_set1_ps((float) m_src.rows);
+                const __m128 one = _mm_set1_ps(1.0f);
+                const __m128 scale = _mm_set1_ps((float) kOne);
+                const __m128 half = _mm_set1_ps(0.5f);
+                const __m128 roundOne = _mm_set1_ps((float) (kOne >> 1));
+                const __m128 invOne = _mm_set1_ps(1.0f / kOne);
+                const __m128i one32 = _mm_set1_epi32(kOne);
+                const __m128i minusOne32 = _mm_set1_epi32(-1);
+                const __m128i minusTwo32 = _mm_set1_epi32(-2);
+                const __m128i cols32 = _mm_set1_epi32(m_src.cols);
+                const __m128i cols32m1 = _mm_set1_epi32(m_src.cols - 1);
+                const __m128i rows32 = _mm_set1_epi32(m_src.rows);
+                const __m128i rows32m1 = _mm_set1_epi32(m_src.rows - 1);
+
+                for (; j + 4 <= n; j += 4)
+                {
+                    // maxps returns its second operand for NaN, so NaN ends up at -1 like in sample()
+                    __m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(xs + j), minusOne), maxX);
+                    __m128 y = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(ys + j), minusOne), maxY);
+
+                    // Floor of positions >= -1: truncate, then step down where truncation rounded up
+                    __m128 fx0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+                    __m128 fy0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+                    fx0 = _mm_sub_ps(fx0, _mm_and_ps(_mm_cmpgt_ps(fx0, x), one));
+                    fy0 = _mm_sub_ps(fy0, _mm_and_ps(_mm_cmpgt_ps(fy0, y), one));
+                    __m128i ix = _mm_cvttps_epi32(fx0);
+                    __m128i iy = _mm_cvttps_epi32(fy0);
+
+                    // Fixed point weights of the right and lower taps
+                    __m128i wx = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(x, fx0), scale), half));
+                    __m128i wy = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(y, fy0), scale), half));
+
+                    // Tap weights, the rounded shift of wx * wy is an exact float product scaled by a power of two
+                    __m128 wxy = _mm_mul_ps(_mm_cvtepi32_ps(wx), _mm_cvtepi32_ps(wy));
+                    __m128i w3 = _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(wxy, roundOne), invOne));
+                    __m128i w1 = _mm_sub_epi32(wx, w3);
+                    __m128i w2 = _mm_sub_epi32(wy, w3);
+                    __m128i w0 = _mm_sub_epi32(_mm_sub_epi32(_mm_sub_epi32(one32, w1), w2), w3);
+
+                    // Validity of the tap columns and rows, positions lie within [-1, cols] x [-1, rows]
+                    __m128i inX0 = _mm_and_si128(_mm_cmpgt_epi32(ix, minusOne32), _mm_cmplt_epi32(ix, cols32));
+                    __m128i inX1 = _mm_and_si128(_mm_cmpgt_epi32(ix, minusTwo32), _mm_cmplt_epi32(ix, cols32m1));
+                    __m128i inY0 = _mm_and_si128(_mm_cmpgt_epi32(iy, minusOne32), _mm_cmplt_epi32(iy, rows32));
+                    __m128i inY1 = _mm_and_si128(_mm_cmpgt_epi32(iy, minusTwo32), _mm_cmplt_epi32(iy, rows32m1));
+                    __m128i cov = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(w0, _mm_and_si128(inX0, inY0)), _mm_and_si128(w1, _mm_and_si128(inX1, inY0))),
+                                                _mm_add_epi32(_mm_and_si128(w2, _mm_and_si128(inX0, inY1)), _mm_and_si128(w3, _mm_and_si128(inX1, inY1))));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(coverage + j), cov);
+
+                    int ixs[4], iys[4], w[4][4];
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(ixs), ix);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(iys), iy);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(w[0]), w0);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(w[1]), w1);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(w[2]), w2);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(w[3]), w3);
+                    for (int l = 0; l < 4; ++l)
+                    {
+                        int wl[4] = { w[0][l], w[1][l], w[2][l], w[3][l] };
+                        taps(ixs[l], iys[l], wl, acc + 3 * (j + l));
+                    }
+                }
+            }
+#endif
+            for (; j < n; ++j)
+            {
+                coverage[j] = sample(xs[j], ys[j], acc + 3 * j);
+            }
+        }
+
+    private:
+
+        // Integer dot product of the four taps at (ix, iy) with their weights per channel
+        void taps(int ix, int iy, const int w[4], int acc[3]) const
+        {
+            // Rows -1 .. rows + 1 and columns -1 .. cols + 1 lie within the border
+            const T* row0 = reinterpret_cast<const T*>(m_src.data + (ptrdiff_t) iy * m_src.step[0]) + 3 * ix;
+            const T* row1 = reinterpret_cast<const T*>(reinterpret_cast<const uchar*>(row0) + m_src.step[0]);
+            const T* tap[4] = { row0, row0 + 3, row1, row1 + 3 };
+
+            for (int ch = 0; ch < 3; ++ch)
+            {
+                int sum = 0;
+                for (int t = 0; t < 4; ++t)
+                {
+                    sum += w[t] * tap[t][ch];
+                }
+                acc[ch] = sum;
+            }
+        }
+
+        // Sampled image
+        const cv::Mat& m_src;
+};
+
+#endif // VIDEOSTAB_BILINEARSAMPLER_HPP
@@ -0,0 +1,65 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: ConvergenceMonitor.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <algorithm>
+
+// User libraries
+#include "ConvergenceMonitor.hpp"
+
+// Constructor
+ConvergenceMonitor::ConvergenceMonitor(double threshold, int patience) : m_threshold(threshold), m_patience(std::max(1, patience)), m_numFrames(0), m_numQuietSteps(0), m_lastChange(0.0)
+{
+}
+
+
+// Start with the sum of the given number of frames
+void ConvergenceMonitor::reset(const cv::Mat& sum, int numFrames)
+{
+    m_numFrames = numFrames;
+    m_numQuietSteps = 0;
+    m_lastChange = 0.0;
+    sum.convertTo(m_average, CV_32FC3, 1.0 / std::max(1, m_numFrames));
+}
+
+
+// Add the sum after the given number of further frames
+bool ConvergenceMonitor::addFrames(const cv::Mat& sum, int numFrames)
+{
+    m_numFrames += numFrames;
+
+    cv::Mat average;
+    sum.convertTo(average, CV_32FC3, 1.0 / m_numFrames);
+
+    m_lastChange = cv::norm(average, m_average, cv::NORM_L1) / std::max<double>(1.0, average.total() * average.channels());
+    m_average = average;
+
+    m_numQuietSteps = m_lastChange < m_threshold ? m_numQuietSteps + 1 : 0;
+    return converged();
+}
+
+
+// Return true if converged
+bool ConvergenceMonitor::converged() const
+{
+    return m_numQuietSteps >= m_patience;
+}
+
+
+// Return change of the last step
+double ConvergenceMonitor::lastChange() const
+{
+    return m_lastChange;
+}
+
+
+// Return number of frames in the sum
+int ConvergenceMonitor::numFrames() const
+{
+    return m_numFrames;
+}
@@ -0,0 +1,62 @@
+/**************************************
+ * Header file: ConvergenceMonitor.hpp
+ *
+ * Detects when the running average of
+ * the aligned frames stops changing
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_CONVERGENCEMONITOR_HPP
+#define VIDEOSTAB_CONVERGENCEMONITOR_HPP
+
+// OpenCV libraries
+#include <opencv2/core/core.hpp>
+
+// Follows a downsampled copy of the sum of aligned frames frame by frame
+// The change of a step is the mean absolute difference of the running average (8-bit units) before and after it,
+// the exposure has converged once the change stayed below the threshold for the given number of consecutive steps
+class ConvergenceMonitor
+{
+
+    public:
+
+        // Constructor takes the threshold (8-bit units) and the number of consecutive steps below it
+        ConvergenceMonitor(double, int);
+
+        // Start with the downsampled sum of the given number of frames (the reference frame)
+        void reset(const cv::Mat&, int);
+
+        // Add the downsampled sum after the given number of further frames (a frame and its sub-frames), return true once converged
+        bool addFrames(const cv::Mat&, int);
+
+        // Return true if converged
+        bool converged() const;
+
+        // Return change of the last step
+        double lastChange() const;
+
+        // Return number of frames in the sum
+        int numFrames() const;
+
+    private:
+
+        // Running average of the last added sum, CV_32FC3
+        cv::Mat m_average;
+
+        // Threshold of the change in 8-bit units
+        double m_threshold;
+
+        // Number of consecutive steps below the threshold to converge
+        int m_patience;
+
+        // Number of frames in the sum
+        int m_numFrames;
+
+        // Consecutive steps below the threshold so far
+        int m_numQuietSteps;
+
+        // Change of the last step
+        double m_lastChange;
+};
+
+#endif // VIDEOSTAB_CONVERGENCEMONITOR_HPP
@@ -0,0 +1,66 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: CroppedFrameSource.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <utility>
+
+// User libraries
+#include "CroppedFrameSource.hpp"
+
+// Constructor
+CroppedFrameSource::CroppedFrameSource(std::unique_ptr<FrameSource> source, const cv::Rect& crop) : m_source(std::move(source)), m_crop(crop)
+{
+}
+
+
+// Read the next frame and copy the rectangle out of it
+// The rectangle is clipped to the frame, the copy is a new buffer like every decoded frame
+bool CroppedFrameSource::read(cv::Mat& frame)
+{
+    if (!m_source->read(m_frame))
+    {
+        return false;
+    }
+    frame = m_frame(m_crop & cv::Rect(0, 0, m_frame.cols, m_frame.rows)).clone();
+    return true;
+}
+
+
+// Seek the decoding source
+bool CroppedFrameSource::seek(int pos)
+{
+    return m_source->seek(pos);
+}
+
+
+// Return index of the next frame
+int CroppedFrameSource::position() const
+{
+    return m_source->position();
+}
+
+
+// Return number of frames of the video
+int CroppedFrameSource::frameCount() const
+{
+    return m_source->frameCount();
+}
+
+
+// Return frames per second of the video
+double CroppedFrameSource::frameRate() const
+{
+    return m_source->frameRate();
+}
+
+
+// Print the statistics of the decoding source
+void CroppedFrameSource::printStats() const
+{
+    m_source->printStats();
+}
@@ -0,0 +1,52 @@
+/**************************************
+ * Header file: CroppedFrameSource.hpp
+ *
+ * Hands out a rectangle of the frames
+ * of another frame source
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_CROPPEDFRAMESOURCE_HPP
+#define VIDEOSTAB_CROPPEDFRAMESOURCE_HPP
+
+// C++ std libraries
+#include <memory>
+
+// User libraries
+#include "FrameSource.hpp"
+
+// Frames are decoded in full by the wrapped source, the rectangle is copied out right away,
+// so everything downstream of the decoder only works on (and keeps) the rectangle
+class CroppedFrameSource : public FrameSource
+{
+
+    public:
+
+        // Constructor takes ownership of the decoding source and the rectangle in frame coordinates
+        CroppedFrameSource(std::unique_ptr<FrameSource>, const cv::Rect&);
+
+        virtual bool read(cv::Mat&);
+
+        virtual bool seek(int);
+
+        virtual int position() const;
+
+        virtual int frameCount() const;
+
+        virtual double frameRate() const;
+
+        virtual void printStats() const;
+
+    private:
+
+        // Decoding source
+        std::unique_ptr<FrameSource> m_source;
+
+        // Rectangle handed out
+        cv::Rect m_crop;
+
+        // Full frame, reused for every read
+        cv::Mat m_frame;
+};
+
+#endif // VIDEOSTAB_CROPPEDFRAMESOURCE_HPP
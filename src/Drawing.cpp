@@ -4,11 +4,10 @@
 
 #include <iostream>
 #include <algorithm>
+#include <fstream>
 #include <opencv2/imgproc.hpp>
 #include "Drawing.hpp"
 
-static const std::string kDstFolder = "/tmp/";
-
 // Show keypoints
 void Drawing::showKeypoints(const cv::Mat& img, const std::vector<cv::Point2f>& keypoints)
 {
@@ -70,10 +69,54 @@ void Drawing::showImg32f(cv::Mat& img)
 
 
 // Save image
+// @fileName: output path without file extension
 void Drawing::saveImg(const cv::Mat& img, const std::string fileName)
 {
-    cv::imwrite(kDstFolder + "/vidstab/images/" + fileName + ".jpg", img);
-    std::cout << kDstFolder + "vidstab/images/" + fileName << ".jpg" << " successfully saved..." << std::endl;
+    cv::imwrite(fileName + ".jpg", img);
+    std::cout << fileName << ".jpg" << " successfully saved..." << std::endl;
+}
+
+
+// Save a CV_32FC3 image in 8-bit units without clipping it to 8 bits
+// @fileName: output path without file extension
+// @format:   png or tiff (16-bit, 8-bit units scaled by 257 so 255 maps to 65535), float (headerless BGR float rows, .f32)
+bool Drawing::saveHdrImg(const cv::Mat& img, const std::string& fileName, const std::string& format)
+{
+    if (format == "float")
+    {
+        return saveRawFloat(img, fileName + ".f32");
+    }
+
+    std::string path = fileName + (format == "tiff" ? ".tif" : ".png");
+    cv::Mat img16u;
+    img.convertTo(img16u, CV_16UC3, 257.0);
+    if (!cv::imwrite(path, img16u))
+    {
+        std::cout << "cannot write " << path << std::endl;
+        return false;
+    }
+    std::cout << path << " successfully saved..." << std::endl;
+    return true;
+}
+
+
+// Save an image as headerless rows of its raw element data
+bool Drawing::saveRawFloat(const cv::Mat& img, const std::string& path)
+{
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "cannot write " << path << std::endl;
+        return false;
+    }
+
+    size_t rowBytes = img.cols * img.elemSize();
+    for (int i = 0; i < img.rows; ++i)
+    {
+        file.write(reinterpret_cast<const char*>(img.ptr(i)), rowBytes);
+    }
+    std::cout << path << " (" << img.cols << "x" << img.rows << " BGR float) successfully saved..." << std::endl;
+    return file.good();
 }
 
 
@@ -99,7 +142,15 @@ void Drawing::saveBestFeatures(const cv::Mat& img, const std::vector<cv::Point2f
 void Drawing::saveFeatureVecs(VideoFrame& frame1, VideoFrame& frame2, const std::vector<cv::Point2f>& frame2Keypoints, const std::vector<int>& bestFeatures, const std::string& fileName)
 {
     cv::Mat outImg;
-    frame2.getAlignedFrameData32f().copyTo(outImg);
+    if (frame2.getAlignedFrameData32f().empty())
+    {
+        // Compact frames are aligned in 16-bit fixed point
+        frame2.getAlignedFrameData16u().convertTo(outImg, CV_8UC3, 1.0 / 256);
+    }
+    else
+    {
+        frame2.getAlignedFrameData32f().copyTo(outImg);
+    }
     saveImg(drawFeatureVecs(frame1, frame2Keypoints, bestFeatures, outImg), fileName);
 }
 
@@ -27,6 +27,10 @@ class Drawing
         static void showImg32f(cv::Mat&);
 
         static void saveImg(const cv::Mat&, const std::string);
+
+        static bool saveHdrImg(const cv::Mat&, const std::string&, const std::string&);
+
+        static bool saveRawFloat(const cv::Mat&, const std::string&);
         
         static void saveBestFeatures(const cv::Mat&, const std::vector<cv::Point2f>&, const std::vector<int>&, const std::string&);
 
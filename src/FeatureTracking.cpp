@@ -8,6 +8,10 @@
 
 // C++ std libraries
 #include <iostream>
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <stdexcept>
 
 // OpenCV libraries
 #include <opencv2/core/core.hpp>
@@ -17,10 +21,11 @@
 #include "FeatureTracking.hpp"
 #include "FeatureTrackingParams.hpp"
 #include "Drawing.hpp"
+#include "ThreadPool.hpp"
 
 
 // Constructor
-FeatureTracking::FeatureTracking(const std::string& fileName) : m_fileName(fileName)
+FeatureTracking::FeatureTracking(const std::string& outputPrefix) : m_outputPrefix(outputPrefix), m_pool(0)
 {
     
     // Params for cv::goodFeaturesToTrack
@@ -38,6 +43,20 @@ FeatureTracking::FeatureTracking(const std::string& fileName) : m_fileName(fileN
 }
 
 
+// Set the output path prefix of the debug images
+void FeatureTracking::setOutputPrefix(const std::string& outputPrefix)
+{
+    m_outputPrefix = outputPrefix;
+}
+
+
+// Set the workers detecting the features of the subdomains
+void FeatureTracking::setThreadPool(ThreadPool* pool)
+{
+    m_pool = pool;
+}
+
+
 // Compute good features in the current frame, proceed by domain decomposition to find uniformely distributed features
 // @maxNumFeatures: max features that should be found with given quality level
 // @domainSplit: split domain in subdomains, default = 0
@@ -48,7 +67,7 @@ int FeatureTracking::computeGoodFeatures(VideoFrame& vidFrame)
 
     // Convert frame to grayscale image
     cv::Mat greyScaleFrameData;
-    cv::cvtColor(vidFrame.getFrameData(), greyScaleFrameData, cv::COLOR_RGB2GRAY);
+    vidFrame.getGreyFrameData(greyScaleFrameData);
 
     // Constant number of subdomains
     int xStep = 4;
@@ -58,18 +77,20 @@ int FeatureTracking::computeGoodFeatures(VideoFrame& vidFrame)
     // Calculate the number of features in each subdomain
     int numFeatsDom = (int) (m_ftParams.maxNumFeat / numSubDoms);
   
-    // Initialize temp vector to store intermediate results (keypoints)
-    std::vector<cv::Point2f> tmpKeypts;
-    tmpKeypts.resize(numFeatsDom);
+    // Intermediate results (keypoints) of every subdomain, appended in subdomain order
+    std::vector<std::vector<cv::Point2f> > subDomKeypts(numSubDoms);
 
     // Create mask container for region of interest
-    float frameWidth = vidFrame.getFrameData32f().size().width;
-    float frameHeight = vidFrame.getFrameData32f().size().height;
+    float frameWidth = vidFrame.getFrameData().size().width;
+    float frameHeight = vidFrame.getFrameData().size().height;
 
 
     int segWidth = (int) (frameWidth / xStep);
     int segHeight = (int) (frameHeight / yStep);
 
+    // Detection tasks of this frame
+    TaskGroup detections;
+
     for (int dy = 0; dy < yStep; ++dy)
     {
         for (int dx = 0; dx < xStep; ++dx)
@@ -79,18 +100,41 @@ int FeatureTracking::computeGoodFeatures(VideoFrame& vidFrame)
             // This is a static approach that supposes aspect ration 4:3
             int x = dx * segWidth;
             int y = dy * segHeight;
-
-            // Create mask from segment data
-            cv::Mat subDomainMask = cv::Mat::zeros(frameHeight, frameWidth, CV_8UC1);
-            subDomainMask(cv::Rect(x, y, segWidth, segHeight)) = (unsigned char) 255;
-            
-            // Find good features to track using segment mask
-            cv::goodFeaturesToTrack(greyScaleFrameData, tmpKeypts, numFeatsDom, m_ftParams.qualLev, m_ftParams.minDist, subDomainMask, m_ftParams.blSize, m_ftParams.harrCor);
-            vidFrame.getKeypoints().insert(vidFrame.getKeypoints().end(), tmpKeypts.begin(), tmpKeypts.end());
+            int d = dy * xStep + dx;
+
+            std::function<void()> detect = [this, &greyScaleFrameData, &subDomKeypts, d, x, y, segWidth, segHeight, frameWidth, frameHeight, numFeatsDom]()
+            {
+                // Create mask from segment data
+                cv::Mat subDomainMask = cv::Mat::zeros(frameHeight, frameWidth, CV_8UC1);
+                subDomainMask(cv::Rect(x, y, segWidth, segHeight)) = (unsigned char) 255;
+
+                // Find good features to track using segment mask
+                cv::goodFeaturesToTrack(greyScaleFrameData, subDomKeypts[d], numFeatsDom, m_ftParams.qualLev, m_ftParams.minDist, subDomainMask, m_ftParams.blSize, m_ftParams.harrCor);
+            };
+
+            // The subdomains are independent, each one is a task of the pool
+            if (m_pool)
+            {
+                m_pool->submit(detections, detect, d);
+            }
+            else
+            {
+                detect();
+            }
 
         }
     }
 
+    if (m_pool)
+    {
+        m_pool->wait(detections);
+    }
+
+    for (int d = 0; d < numSubDoms; ++d)
+    {
+        vidFrame.getKeypoints().insert(vidFrame.getKeypoints().end(), subDomKeypts[d].begin(), subDomKeypts[d].end());
+    }
+
     // Initialize feature data structure to save motion vectors
     vidFrame.getFeatureData() = std::vector<FFeature>(vidFrame.getKeypoints().size());
 
@@ -104,6 +148,37 @@ int FeatureTracking::refineGoodFeatures(VideoFrame& vidFrame, std::vector<int>&
 {
 
     // Find range of best features
+    cv::Rect range = bestFeatureRange(vidFrame, bestFeatures);
+
+    // Notify when frame succesfully processed
+    std::cout << "range: x: " << range.x << " - " << range.x + range.width << ", y: " << range.y << " - " << range.y + range.height << std::endl;
+    // Convert frame to grayscale image
+    cv::Mat greyScaleFrameData;
+    vidFrame.getGreyFrameData(greyScaleFrameData);
+ 
+    cv::Mat mask = cv::Mat::zeros(greyScaleFrameData.size(), CV_8UC1);
+    mask(range) = (unsigned char) 255;
+
+    // Detect good features using cv::goodFeaturesToTrack with mask
+    cv::goodFeaturesToTrack(greyScaleFrameData, vidFrame.getKeypoints(), m_ftParams.maxNumFeat, m_ftParams.qualLev, m_ftParams.minDist, mask, m_ftParams.blSize, m_ftParams.harrCor);    
+
+    // Resize feature data vector
+    vidFrame.getFeatureData().resize(vidFrame.getKeypoints().size());
+
+    return vidFrame.getKeypoints().size();
+}
+
+
+// Bounding range of the best features of a frame, in whole pixels
+// The whole frame if there are no best features
+cv::Rect FeatureTracking::bestFeatureRange(VideoFrame& vidFrame, const std::vector<int>& bestFeatures)
+{
+
+    if (bestFeatures.empty())
+    {
+        return cv::Rect(cv::Point(0, 0), vidFrame.getFrameSize());
+    }
+
     // @range: minX = range[0], maxX = range[1], minY = range[2], maxY = range[3]
     int range[] = {99999, -99999, 99999, -99999};
 
@@ -130,109 +205,334 @@ int FeatureTracking::refineGoodFeatures(VideoFrame& vidFrame, std::vector<int>&
         }
     }
 
-    // HARDCODDED RANGE - USER SPECIFIED REGION OF INTEREST
-   
-    /*
-    range[0] = 440.0;
-    range[1] = 620.0;
-    range[2] = 470.0;
-    range[3] = 540.0;
-    */
-
-    // Notify when frame succesfully processed
-    std::cout << "range: x: " << range[0] << " - " << range[1] << ", y: " << range[2] << " - " << range[3] << std::endl;
-    // Convert frame to grayscale image
-    cv::Mat greyScaleFrameData;
-    cv::cvtColor(vidFrame.getFrameData32f(), greyScaleFrameData, cv::COLOR_RGB2GRAY);
- 
-    // @range: minX = range[0], maxX = range[1], minY = range[2], maxY = range[3]
-    cv::Mat mask = cv::Mat::zeros(greyScaleFrameData.size(), CV_8UC1);
-    mask(cv::Rect(range[0],range[2],range[1]-range[0],range[3]-range[2])) = (unsigned char) 255;
-
-    // Detect good features using cv::goodFeaturesToTrack with mask
-    cv::goodFeaturesToTrack(greyScaleFrameData, vidFrame.getKeypoints(), m_ftParams.maxNumFeat, m_ftParams.qualLev, m_ftParams.minDist, mask, m_ftParams.blSize, m_ftParams.harrCor);    
-
-    // Resize feature data vector
-    vidFrame.getFeatureData().resize(vidFrame.getKeypoints().size());
-
-    return vidFrame.getKeypoints().size();
+    return cv::Rect(range[0], range[2], range[1] - range[0], range[3] - range[2]);
 }
 
 
 // Processed by KLT
 // initialMotion: calculate the initial feature motion
 // @return: number of good features to track
-void FeatureTracking::initialMotion(VideoFrame& refFrame, cv::VideoCapture& vidCapt, int numFrames, std::vector<int>& bestFeatures)
+void FeatureTracking::initialMotion(VideoFrame& refFrame, FrameSource& forwardSource, FrameSource& backwardSource, int refIndex, int numFrames, std::vector<int>& bestFeatures)
 {
+
+    std::vector<std::vector<cv::Point2f> > keypoints;
+    std::vector<int> frameIndices;
+    trackBidirectional(refFrame, forwardSource, backwardSource, refIndex, numFrames, bestFeatures, keypoints, frameIndices);
+
+    std::cout << "initial feature tracking done..." << std::endl;
+
+    Drawing::saveBestFeatures(refFrame.getFrameData(), refFrame.getKeypoints(), bestFeatures, m_outputPrefix + "_FeatureDetection1");
     
+    Drawing::saveKeypoints(refFrame.getFrameData(), refFrame.getKeypoints(), bestFeatures, m_outputPrefix + "_FeatureDetection1_Keypoints");
+}
+
+
+// Calculate refined feature motion based a range analysis
+// @keypoints, @frameIndices: keypoints and frame index of every window frame in frame order, the reference frame excluded
+void FeatureTracking::refinedMotion(VideoFrame& refFrame, FrameSource& forwardSource, FrameSource& backwardSource, int refIndex, int numFrames, std::vector<int>& bestFeatures, std::vector<std::vector<cv::Point2f> >& keypoints, std::vector<int>& frameIndices)
+{
+
+    trackBidirectional(refFrame, forwardSource, backwardSource, refIndex, numFrames, bestFeatures, keypoints, frameIndices);
+
+    std::cout << "refined feature tracking done..." << std::endl;
+
+    Drawing::saveBestFeatures(refFrame.getFrameData(), refFrame.getKeypoints(), bestFeatures, m_outputPrefix + "_FeatureDetection2");
+
+    Drawing::saveKeypoints(refFrame.getFrameData(), refFrame.getKeypoints(), bestFeatures, m_outputPrefix + "_FeatureDetection2_Keypoints");
+}
+
+
+// Number of window frames before the reference frame
+// The window is symmetric around the reference frame, an odd frame goes to the forward side
+int FeatureTracking::numBackwardFrames(int refIndex, int numFrames)
+{
+    return std::max(0, std::min(numFrames / 2, refIndex));
+}
+
+
+// Merge the best features into control points
+// Greedy pass in best feature order: a track joins the nearest control point within the radius whose mean track
+// it follows within the motion tolerance in every window frame, otherwise it starts a new control point.
+// The radius starts at half the spacing of maxPoints points spread over the frame, radius and tolerance grow
+// until at most maxPoints control points remain, so the morph cost is bounded even if the motion is not consistent.
+int FeatureTracking::clusterControlPoints(VideoFrame& refFrame, std::vector<std::vector<cv::Point2f> >& keypoints, std::vector<int>& bestFeatures, int maxPoints, float motionTolerance)
+{
+    std::vector<cv::Point2f>& refKeypts = refFrame.getKeypoints();
+    int numTracks = bestFeatures.size();
+    int numFrames = keypoints.size();
+
+    if (maxPoints <= 0 || numTracks <= maxPoints)
+    {
+        return numTracks;
+    }
+
+    // Sums of the merged tracks, in the reference frame and in every window frame
+    struct ControlPoint
+    {
+        cv::Point2f refSum;
+        std::vector<cv::Point2f> sums;
+        int count;
+    };
+
+    cv::Size frameSize = refFrame.getFrameSize();
+    float radius = 0.5f * std::sqrt((float) frameSize.area() / maxPoints);
+    float tolerance = std::max(motionTolerance, 0.01f);
+
+    std::vector<ControlPoint> points;
+    while (true)
+    {
+        points.clear();
+        for (int i = 0; i < numTracks; ++i)
+        {
+            int t = bestFeatures[i];
+            cv::Point2f refPos = refKeypts[t];
+
+            int best = -1;
+            float bestDist = radius;
+            for (int c = 0; c < points.size(); ++c)
+            {
+                float invCount = 1.0f / points[c].count;
+                cv::Point2f center = points[c].refSum * invCount;
+                float dist = cv::norm(refPos - center);
+                if (dist > bestDist)
+                {
+                    continue;
+                }
+
+                // Consistent motion: the track follows the mean track in every window frame
+                bool consistent = true;
+                for (int f = 0; f < numFrames && consistent; ++f)
+                {
+                    cv::Point2f meanDisp = points[c].sums[f] * invCount - center;
+                    consistent = cv::norm(keypoints[f][t] - refPos - meanDisp) <= tolerance;
+                }
+
+                if (consistent)
+                {
+                    best = c;
+                    bestDist = dist;
+                }
+            }
+
+            if (best < 0)
+            {
+                ControlPoint point;
+                point.refSum = refPos;
+                point.sums.resize(numFrames);
+                for (int f = 0; f < numFrames; ++f)
+                {
+                    point.sums[f] = keypoints[f][t];
+                }
+                point.count = 1;
+                points.push_back(point);
+            }
+            else
+            {
+                points[best].refSum += refPos;
+                for (int f = 0; f < numFrames; ++f)
+                {
+                    points[best].sums[f] += keypoints[f][t];
+                }
+                points[best].count++;
+            }
+        }
+
+        if (points.size() <= maxPoints)
+        {
+            break;
+        }
+        radius *= 1.5f;
+        tolerance *= 1.5f;
+    }
+
+    // Replace the tracks by the mean tracks of the control points
+    std::vector<float> weights(points.size());
+    refKeypts.resize(points.size());
+    bestFeatures.resize(points.size());
+    for (int c = 0; c < points.size(); ++c)
+    {
+        float invCount = 1.0f / points[c].count;
+        refKeypts[c] = points[c].refSum * invCount;
+        weights[c] = points[c].count;
+        bestFeatures[c] = c;
+    }
+    for (int f = 0; f < numFrames; ++f)
+    {
+        keypoints[f].resize(points.size());
+        for (int c = 0; c < points.size(); ++c)
+        {
+            keypoints[f][c] = points[c].sums[f] * (1.0f / points[c].count);
+        }
+    }
+    refFrame.setFeatureWeights(weights);
+
+    std::cout << "control points: " << numTracks << " best features merged into " << points.size() << " (radius " << radius << " px, motion tolerance " << tolerance << " px)" << std::endl;
+
+    return points.size();
+}
+
+
+// Track forward and backward from the reference frame concurrently
+// Both directions start from the same reference keypoints, so drift is balanced on both sides of the window
+void FeatureTracking::trackBidirectional(VideoFrame& refFrame, FrameSource& forwardSource, FrameSource& backwardSource, int refIndex, int numFrames, std::vector<int>& bestFeatures, std::vector<std::vector<cv::Point2f> >& keypoints, std::vector<int>& frameIndices)
+{
+
+    // The window ends at the first and the last frame of the video
+    int numBackward = numBackwardFrames(refIndex, numFrames);
+    int numForward = numFrames - numBackward;
+    int frameCount = forwardSource.frameCount();
+    if (frameCount > 0)
+    {
+        numForward = std::max(0, std::min(numForward, frameCount - refIndex - 1));
+    }
+
+    // Keypoints in tracking order, i.e. with increasing distance to the reference frame
+    std::vector<std::vector<cv::Point2f> > forwardKeypts, backwardKeypts;
+    VideoFrame forwardEnd, backwardEnd;
+
+    // The backward direction runs on its own thread and decoder, the forward direction on this thread
+    std::future<void> backward = std::async(std::launch::async, &FeatureTracking::trackBackward, std::cref(refFrame), std::ref(backwardSource), refIndex, numBackward, std::ref(backwardKeypts), std::ref(backwardEnd));
+    trackForward(refFrame, forwardSource, refIndex, numForward, forwardKeypts, forwardEnd);
+    backward.get();
+
+    // A failed read ends the window on its side
+    if (forwardKeypts.size() + backwardKeypts.size() < numFrames)
+    {
+        std::cout << "window shrunk to " << backwardKeypts.size() << " frames before and " << forwardKeypts.size() << " frames after reference frame " << refIndex << std::endl;
+    }
+    numBackward = backwardKeypts.size();
+    numForward = forwardKeypts.size();
+    if (numBackward + numForward == 0)
+    {
+        throw std::runtime_error("no window frame could be read around the reference frame");
+    }
+
+    // Window frames in frame order
+    keypoints.clear();
+    frameIndices.clear();
+    for (int i = numBackward - 1; i >= 0; --i)
+    {
+        keypoints.push_back(backwardKeypts[i]);
+        frameIndices.push_back(refIndex - 1 - i);
+    }
+    for (int i = 0; i < numForward; ++i)
+    {
+        keypoints.push_back(forwardKeypts[i]);
+        frameIndices.push_back(refIndex + 1 + i);
+    }
+
+    // Find best features based on the cummulated errors of both window ends
+    if (numForward == 0)
+    {
+        backwardEnd.findBestFeatures(bestFeatures);
+        return;
+    }
+    if (numBackward > 0)
+    {
+        forwardEnd.combineFeatureData(backwardEnd);
+    }
+    forwardEnd.findBestFeatures(bestFeatures);
+}
+
+
+// Track the features of the reference frame over the numFrames frames following it
+// Tracking stops at the first frame that cannot be read, keypoints then holds the frames tracked so far
+// @lastFrame: last tracked frame, holding the cummulated feature data
+void FeatureTracking::trackForward(const VideoFrame& refFrame, FrameSource& frameSource, int refIndex, int numFrames, std::vector<std::vector<cv::Point2f> >& keypoints, VideoFrame& lastFrame)
+{
+
     // Temporary placeholders 
     VideoFrame currFrame;
     VideoFrame nextFrame = refFrame;
 
+    keypoints.resize(numFrames);
+    frameSource.seek(refIndex + 1);
+
     // Track initial features over remaining video frames
     for (int i = 0; i < numFrames; ++i)
     {
 
         // Update current and next frame
-        currFrame = nextFrame;
         cv::Mat tmpFrame;
-        vidCapt.read(tmpFrame);
+        if (!frameSource.read(tmpFrame) || tmpFrame.empty())
+        {
+            std::cout << "cannot read frame " << refIndex + 1 + i << ", forward tracking stops" << std::endl;
+            keypoints.resize(i);
+            break;
+        }
+        currFrame = nextFrame;
         nextFrame = VideoFrame(tmpFrame);
         
         // Calculate optical flow of features between frames
         currFrame.calcOpticalFlow(nextFrame);
 
         // Copy computed keypoints into the 'global' keypoints container
-        //keypoints[i] = nextFrame.getKeypoints();
-        
-        std::cout << "optical flow between frames " << (vidCapt.get(cv::CAP_PROP_POS_FRAMES) - 1) << " and " << vidCapt.get(cv::CAP_PROP_POS_FRAMES) << " calculated" << std::endl;
+        keypoints[i] = nextFrame.getKeypoints();
 
+        std::cout << "optical flow between frames " << (frameSource.position() - 2) << " and " << (frameSource.position() - 1) << " calculated" << std::endl;
     }
 
-    // Find best features based on the cummulated errors in the last frame
-    nextFrame.findBestFeatures(bestFeatures);
-
-    std::cout << "initial feature tracking done..." << std::endl;
-
-    Drawing::saveBestFeatures(refFrame.getFrameData(), refFrame.getKeypoints(), bestFeatures, "raw/" + m_fileName + "_FeatureDetection1");
-    
-    Drawing::saveKeypoints(refFrame.getFrameData(), refFrame.getKeypoints(), bestFeatures, "raw/" + m_fileName + "_FeatureDetection1_Keypoints");
+    lastFrame = nextFrame;
 }
 
 
-// Calculate refined feature motion based a range analysis
-void FeatureTracking::refinedMotion(VideoFrame& refFrame, cv::VideoCapture& vidCapt, int numFrames, std::vector<int>& bestFeatures, std::vector<std::vector<cv::Point2f> >& keypoints)
+// Track the features of the reference frame over the numFrames frames preceding it, nearest frame first
+// Sources decode forward only and seeking back may decode from the start, so the window is decoded once
+// from its first frame, kept in grey (one byte per pixel) and tracked in reverse
+// A frame that cannot be read ends the window, keypoints then holds the frames after it
+// @lastFrame: last tracked (i.e. first window) frame, holding the cummulated feature data
+void FeatureTracking::trackBackward(const VideoFrame& refFrame, FrameSource& frameSource, int refIndex, int numFrames, std::vector<std::vector<cv::Point2f> >& keypoints, VideoFrame& lastFrame)
 {
 
     // Temporary placeholders 
     VideoFrame currFrame;
     VideoFrame nextFrame = refFrame;
-    
-    // Track initial features over remaining video frames
-    for (int i = 0; i < numFrames; ++i)
+
+    // Grey window frames in frame order, the frames before a gap are dropped
+    int first = refIndex - numFrames;
+    std::vector<cv::Mat> greyFrames;
+    greyFrames.reserve(numFrames);
+    frameSource.seek(first);
+    for (int k = 0; k < numFrames; ++k)
     {
-        
-        // Update current and next frame
+        cv::Mat frame;
+        if (!frameSource.read(frame) || frame.empty())
+        {
+            std::cout << "cannot read frame " << first + k << ", backward tracking stops there" << std::endl;
+            greyFrames.clear();
+            if (k + 1 < numFrames && !frameSource.seek(first + k + 1))
+            {
+                break;
+            }
+            continue;
+        }
+
+        cv::Mat grey;
+        cv::cvtColor(frame, grey, cv::COLOR_RGB2GRAY);
+        if (grey.depth() == CV_16U)
+        {
+            grey.convertTo(grey, CV_8U, 1.0 / 256);
+        }
+        greyFrames.push_back(grey);
+    }
+
+    // Track through the window in reverse, a frame is released once it is tracked
+    int numRead = greyFrames.size();
+    keypoints.resize(numRead);
+    for (int done = 0; done < numRead; ++done)
+    {
+        int k = numRead - 1 - done;
         currFrame = nextFrame;
-        cv::Mat tmpFrame;
-        vidCapt.read(tmpFrame);
-        nextFrame = VideoFrame(tmpFrame);
+        nextFrame = VideoFrame(greyFrames[k]);
+        greyFrames[k].release();
 
         // Calculate optical flow of features between frames
         currFrame.calcOpticalFlow(nextFrame);
 
-        // Copy computed keypoints into the 'global' keypoints container
-        keypoints[i] = nextFrame.getKeypoints();
+        keypoints[done] = nextFrame.getKeypoints();
 
-        std::cout << "optical flow between frames " << (vidCapt.get(cv::CAP_PROP_POS_FRAMES) - 1) << " and " << vidCapt.get(cv::CAP_PROP_POS_FRAMES) << " calculated" << std::endl;
+        std::cout << "optical flow between frames " << (refIndex - done) << " and " << (refIndex - done - 1) << " calculated" << std::endl;
     }
 
-    // Find best features based on the cummulated errors in the last frame
-    nextFrame.findBestFeatures(bestFeatures);
-
-    std::cout << "refined feature tracking done..." << std::endl;
-
-    Drawing::saveBestFeatures(refFrame.getFrameData(), refFrame.getKeypoints(), bestFeatures, "raw/" + m_fileName + "_FeatureDetection2");
-
-    Drawing::saveKeypoints(refFrame.getFrameData(), refFrame.getKeypoints(), bestFeatures, "raw/" + m_fileName + "_FeatureDetection2_Keypoints");
+    lastFrame = nextFrame;
 }
@@ -9,28 +9,66 @@
 #include <string>
 #include <vector>
 #include "VideoFrame.hpp"
+#include "FrameSource.hpp"
+
+class ThreadPool;
 
 class FeatureTracking
 {
    
-    // File name
-    const std::string& m_fileName;
+    // Output path prefix of the debug images
+    std::string m_outputPrefix;
 
     // Feature tracking parameters
     FeatureTrackingParams m_ftParams;
 
+    // Workers detecting the features of the subdomains, null: detect on the calling thread
+    ThreadPool* m_pool;
+
     public:
 
         // Constructor
         FeatureTracking(const std::string&);
 
+        // Set the output path prefix of the debug images of the next clip
+        void setOutputPrefix(const std::string&);
+
+        // Set the workers detecting the features of the subdomains, null: detect on the calling thread
+        void setThreadPool(ThreadPool*);
+
         int computeGoodFeatures(VideoFrame&);
 
         int refineGoodFeatures(VideoFrame&, std::vector<int>&);
 
-        void initialMotion(VideoFrame&, cv::VideoCapture&, int, std::vector<int>&);
+        // Bounding range of the best features of the frame, the whole frame if there are none
+        static cv::Rect bestFeatureRange(VideoFrame&, const std::vector<int>&);
+
+        // Track the features of the reference frame forward and backward (two frame sources) and select the best features
+        // @refIndex: frame index of the reference frame, @numFrames: frames of the window around it
+        void initialMotion(VideoFrame&, FrameSource&, FrameSource&, int, int, std::vector<int>&);
+
+        // Like initialMotion, also returns the keypoints and frame indices of all window frames in frame order
+        void refinedMotion(VideoFrame&, FrameSource&, FrameSource&, int, int, std::vector<int>&, std::vector<std::vector<cv::Point2f> >&, std::vector<int>&);
+
+        // Number of window frames before the reference frame, the remaining frames follow it
+        static int numBackwardFrames(int, int);
+
+        // Merge close best features with consistent motion into at most maxPoints weighted control points
+        // The reference frame keypoints, the window keypoints and the best features are replaced by the control points,
+        // their weights (number of merged tracks) are set on the reference frame, returns the number of control points
+        // @motionTolerance: max distance (pixels) of a track from the mean track of its control point in any window frame
+        static int clusterControlPoints(VideoFrame&, std::vector<std::vector<cv::Point2f> >&, std::vector<int>&, int, float);
+
+    private:
+
+        // Track forward and backward concurrently, each direction on its own thread and frame source
+        void trackBidirectional(VideoFrame&, FrameSource&, FrameSource&, int, int, std::vector<int>&, std::vector<std::vector<cv::Point2f> >&, std::vector<int>&);
+
+        // Track the reference frame features over the frames following it
+        static void trackForward(const VideoFrame&, FrameSource&, int, int, std::vector<std::vector<cv::Point2f> >&, VideoFrame&);
 
-        void refinedMotion(VideoFrame&, cv::VideoCapture&, int, std::vector<int>&, std::vector<std::vector<cv::Point2f> >&);
+        // Track the reference frame features over the frames preceding it, in reverse order
+        static void trackBackward(const VideoFrame&, FrameSource&, int, int, std::vector<std::vector<cv::Point2f> >&, VideoFrame&);
 
 };
 
@@ -0,0 +1,569 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: FrameAccumulator.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// OpenCV libraries
+#include <opencv2/imgproc/imgproc.hpp>
+
+// User libraries
+#include "FrameAccumulator.hpp"
+#include "VideoFrame.hpp"
+
+namespace {
+
+// Scale of compact samples relative to 8-bit values
+const double kCompactScale = 256.0;
+
+// Add aligned rows to the sum starting at firstRow, coverage, luminance and displacement statistics are collected in the same pass
+// The samples are weighted by their coverage already (out of frame taps read zeros), the statistics are weighted alike
+// @scale: scale of the samples relative to 8-bit values
+template<typename SrcT, typename SumT>
+void addAlignedRows(int firstRow, const cv::Mat& aligned, const cv::Mat& displacement, const cv::Mat& validity, cv::Mat& sum, cv::Mat& coverage, cv::Mat& lumSqSum, cv::Mat& dispSum, bool motionStats, double scale)
+{
+    const float lumScale = 1.0 / scale;
+
+    for (int r = 0; r < aligned.rows; ++r)
+    {
+        int i = firstRow + r;
+        const cv::Vec<SrcT, 3>* src = aligned.ptr<cv::Vec<SrcT, 3> >(r);
+        const float* valid = validity.empty() ? 0 : validity.ptr<float>(r);
+        cv::Vec<SumT, 3>* dst = sum.ptr<cv::Vec<SumT, 3> >(i);
+        float* cov = coverage.ptr<float>(i);
+
+        for (int j = 0; j < sum.cols; ++j)
+        {
+            dst[j][0] += src[j][0];
+            dst[j][1] += src[j][1];
+            dst[j][2] += src[j][2];
+            cov[j] += valid ? valid[j] : 1.0f;
+        }
+
+        if (motionStats)
+        {
+            float* lumSq = lumSqSum.ptr<float>(i);
+            float* disp = dispSum.ptr<float>(i);
+            const float* dispSrc = displacement.empty() ? 0 : displacement.ptr<float>(r);
+
+            for (int j = 0; j < sum.cols; ++j)
+            {
+                float c = valid ? valid[j] : 1.0f;
+                if (c <= 0.0f)
+                {
+                    continue;
+                }
+
+                // BGR luminance, c * L of the covered luminance L, so c * L^2 is added
+                float lum = (0.114f * src[j][0] + 0.587f * src[j][1] + 0.299f * src[j][2]) * lumScale;
+                lumSq[j] += lum * lum / c;
+                if (dispSrc)
+                {
+                    disp[j] += c * dispSrc[j];
+                }
+            }
+        }
+    }
+}
+
+// Number of histogram bins over the 8-bit value range, 4 values per bin
+const int kHistogramBins = 64;
+
+// Width of a histogram bin in 8-bit units
+const float kBinWidth = 256.0f / kHistogramBins;
+
+// Min coverage of a sample counted by the histograms and the running extrema
+const float kMinBlendCoverage = 0.5f;
+
+// Update the histograms and running minimum and maximum with aligned rows
+// Samples mostly outside of the frame are skipped, the others are divided by their coverage
+// @toUnits: scale from sample values to 8-bit units
+template<typename SrcT>
+void addBlendRows(int firstRow, const cv::Mat& aligned, const cv::Mat& validity, cv::Mat& histogram, cv::Mat& minFrame, cv::Mat& maxFrame, float toUnits)
+{
+    for (int r = 0; r < aligned.rows; ++r)
+    {
+        int i = firstRow + r;
+        const SrcT* src = aligned.ptr<SrcT>(r);
+        const float* valid = validity.empty() ? 0 : validity.ptr<float>(r);
+        unsigned short* hist = histogram.empty() ? 0 : histogram.ptr<unsigned short>(i);
+        float* mn = minFrame.empty() ? 0 : minFrame.ptr<float>(i);
+        float* mx = maxFrame.empty() ? 0 : maxFrame.ptr<float>(i);
+
+        for (int k = 0; k < 3 * aligned.cols; ++k)
+        {
+            float c = valid ? valid[k / 3] : 1.0f;
+            if (c < kMinBlendCoverage)
+            {
+                continue;
+            }
+
+            float v = src[k] * toUnits / c;
+            if (hist)
+            {
+                int bin = std::min(kHistogramBins - 1, std::max(0, (int) (v / kBinWidth)));
+                unsigned short& count = hist[k * kHistogramBins + bin];
+                count += (count < 65535);
+            }
+            if (mn)
+            {
+                mn[k] = std::min(mn[k], v);
+            }
+            if (mx)
+            {
+                mx[k] = std::max(mx[k], v);
+            }
+        }
+    }
+}
+
+// Divide every pixel of a sum by its coverage, into a CV_32FC3 result in 8-bit units (may be the sum itself)
+// @scale: scale of the sum relative to 8-bit values
+template<typename SumT>
+void divideByCoverage(const cv::Mat& sum, const cv::Mat& coverage, double scale, cv::Mat& result)
+{
+    result.create(sum.size(), CV_32FC3);
+    for (int i = 0; i < sum.rows; ++i)
+    {
+        const cv::Vec<SumT, 3>* src = sum.ptr<cv::Vec<SumT, 3> >(i);
+        const float* cov = coverage.ptr<float>(i);
+        cv::Vec3f* dst = result.ptr<cv::Vec3f>(i);
+
+        for (int j = 0; j < sum.cols; ++j)
+        {
+            float inv = cov[j] > 0.0f ? (float) (1.0 / (cov[j] * scale)) : 0.0f;
+            dst[j] = cv::Vec3f(src[j][0] * inv, src[j][1] * inv, src[j][2] * inv);
+        }
+    }
+}
+
+// Quantile q of a histogram, samples are assumed to be spread evenly within a bin
+float histogramQuantile(const unsigned short* hist, float q)
+{
+    int n = 0;
+    for (int b = 0; b < kHistogramBins; ++b)
+    {
+        n += hist[b];
+    }
+
+    float target = q * n;
+    int cumulated = 0;
+    for (int b = 0; b < kHistogramBins; ++b)
+    {
+        if (hist[b] > 0 && cumulated + hist[b] >= target)
+        {
+            return (b + (target - cumulated) / hist[b]) * kBinWidth;
+        }
+        cumulated += hist[b];
+    }
+    return 255.0f;
+}
+
+// Mean of the samples between the quantiles trim and 1 - trim of a histogram
+float histogramTrimmedMean(const unsigned short* hist, float trim)
+{
+    int n = 0;
+    for (int b = 0; b < kHistogramBins; ++b)
+    {
+        n += hist[b];
+    }
+
+    float lo = trim * n;
+    float hi = (1.0f - trim) * n;
+    float weightedSum = 0.0f;
+    float weight = 0.0f;
+    int cumulated = 0;
+    for (int b = 0; b < kHistogramBins; ++b)
+    {
+        // Part of the bin within [lo, hi]
+        float overlap = std::min<float>(hi, cumulated + hist[b]) - std::max<float>(lo, cumulated);
+        if (overlap > 0.0f)
+        {
+            weightedSum += overlap * (b + 0.5f) * kBinWidth;
+            weight += overlap;
+        }
+        cumulated += hist[b];
+    }
+    return weight > 0.0f ? weightedSum / weight : histogramQuantile(hist, 0.5f);
+}
+
+// Zero a buffer of the given size and type, its memory is reused if it already has them
+void zeroBuffer(cv::Mat& buffer, const cv::Size& size, int type)
+{
+    buffer.create(size, type);
+    buffer.setTo(cv::Scalar::all(0));
+}
+
+} // namespace
+
+
+// Constructor
+FrameAccumulator::FrameAccumulator() : m_blendMode("mean"), m_trimFraction(0.1), m_numFrames(0), m_compact(false), m_motionStats(false), m_normalized(false)
+{
+}
+
+
+// Select the blend mode
+void FrameAccumulator::setBlendMode(const std::string& blendMode, double trimFraction)
+{
+    m_blendMode = blendMode;
+    m_trimFraction = trimFraction;
+}
+
+
+// Keep the floating point sum in a memory mapped file
+void FrameAccumulator::mapTo(const std::string& path)
+{
+    m_mappedPath = path;
+}
+
+
+// Return true if the sum lives in a memory mapped file
+bool FrameAccumulator::isMapped() const
+{
+    return m_mapping && m_mapping->isOpen();
+}
+
+
+// Divide the sum by the number of frames in place
+void FrameAccumulator::normalize()
+{
+    if (m_normalized || m_compact)
+    {
+        return;
+    }
+    divideByCoverage<float>(m_sum, m_coverage, 1.0, m_sum);
+    m_normalized = true;
+}
+
+
+// Start a new sum with the reference frame data (CV_8UC3 or CV_16UC3)
+void FrameAccumulator::init(const cv::Mat& refFrameData, bool compact, bool motionStats)
+{
+    reset(refFrameData.size(), compact, motionStats);
+
+    // The reference frame is not displaced
+    cv::Mat refSamples;
+    if (m_compact)
+    {
+        refFrameData.convertTo(refSamples, CV_16UC3, VideoFrame::fixedPointScale(refFrameData.depth()));
+    }
+    else
+    {
+        refFrameData.convertTo(refSamples, CV_32FC3);
+    }
+    add(refSamples);
+}
+
+
+// Start a new empty sum
+void FrameAccumulator::reset(const cv::Size& size, bool compact, bool motionStats)
+{
+    m_compact = compact;
+    m_motionStats = motionStats;
+    m_numFrames = 0;
+
+    // The previous sum is dropped if it is a view of its mapped file or was handed out as the average,
+    // otherwise its memory is reused when size and format stay
+    // The mapping of the previous sum is released with the last copy of the accumulator
+    if (m_mapping || m_normalized)
+    {
+        m_sum.release();
+        m_mapping.reset();
+    }
+    m_normalized = false;
+
+    if (m_compact)
+    {
+        zeroBuffer(m_sum, size, CV_32SC3);
+    }
+    else if (!m_mappedPath.empty())
+    {
+        // A fresh file reads as zeros, no page is touched before the first frame is added
+        m_mapping.reset(new MappedFile());
+        if (m_mapping->createReadWrite(m_mappedPath, (size_t) size.area() * 3 * sizeof(float)))
+        {
+            m_sum = cv::Mat(size, CV_32FC3, m_mapping->data());
+        }
+        else
+        {
+            m_mapping.reset();
+            zeroBuffer(m_sum, size, CV_32FC3);
+        }
+    }
+    else
+    {
+        zeroBuffer(m_sum, size, CV_32FC3);
+    }
+    zeroBuffer(m_coverage, size, CV_32FC1);
+
+    if (m_motionStats)
+    {
+        zeroBuffer(m_lumSqSum, size, CV_32FC1);
+        zeroBuffer(m_dispSum, size, CV_32FC1);
+    }
+    else
+    {
+        m_lumSqSum.release();
+        m_dispSum.release();
+    }
+
+    // Streaming estimators of the blend mode, memory independent of the number of frames
+    if (usesHistograms(m_blendMode))
+    {
+        zeroBuffer(m_histogram, cv::Size(size.width * 3 * kHistogramBins, size.height), CV_16UC1);
+    }
+    else
+    {
+        m_histogram.release();
+    }
+    if (m_blendMode == "min")
+    {
+        m_min.create(size, CV_32FC3);
+        m_min.setTo(cv::Scalar::all(FLT_MAX));
+    }
+    else
+    {
+        m_min.release();
+    }
+    if (m_blendMode == "max")
+    {
+        zeroBuffer(m_max, size, CV_32FC3);
+    }
+    else
+    {
+        m_max.release();
+    }
+}
+
+
+// Start a new empty sum like another accumulator
+void FrameAccumulator::resetLike(const FrameAccumulator& other)
+{
+    setBlendMode(other.m_blendMode, other.m_trimFraction);
+    reset(other.size(), other.m_compact, other.m_motionStats);
+}
+
+
+// Add the sums of another accumulator, used to combine partial sums of parallel workers
+void FrameAccumulator::merge(const FrameAccumulator& other)
+{
+    m_sum += other.m_sum;
+    m_coverage += other.m_coverage;
+    if (m_motionStats && other.m_motionStats)
+    {
+        m_lumSqSum += other.m_lumSqSum;
+        m_dispSum += other.m_dispSum;
+    }
+    if (!m_histogram.empty() && !other.m_histogram.empty())
+    {
+        // Saturating 16-bit addition
+        m_histogram += other.m_histogram;
+    }
+    if (!m_min.empty() && !other.m_min.empty())
+    {
+        cv::min(m_min, other.m_min, m_min);
+    }
+    if (!m_max.empty() && !other.m_max.empty())
+    {
+        cv::max(m_max, other.m_max, m_max);
+    }
+    m_numFrames += other.m_numFrames;
+}
+
+
+// Add an aligned frame
+void FrameAccumulator::add(const cv::Mat& aligned, const cv::Mat& displacement, const cv::Mat& validity)
+{
+    addRows(0, aligned, displacement, validity);
+    countFrame();
+}
+
+
+// Add aligned rows, used by the fused warp-and-accumulate path that never holds a whole aligned frame
+void FrameAccumulator::addRows(int firstRow, const cv::Mat& aligned, const cv::Mat& displacement, const cv::Mat& validity)
+{
+    if (m_compact)
+    {
+        addAlignedRows<unsigned short, int>(firstRow, aligned, displacement, validity, m_sum, m_coverage, m_lumSqSum, m_dispSum, m_motionStats, kCompactScale);
+    }
+    else
+    {
+        addAlignedRows<float, float>(firstRow, aligned, displacement, validity, m_sum, m_coverage, m_lumSqSum, m_dispSum, m_motionStats, 1.0);
+    }
+
+    // The rows are still in cache for the blend estimators
+    if (m_blendMode != "mean")
+    {
+        if (m_compact)
+        {
+            addBlendRows<unsigned short>(firstRow, aligned, validity, m_histogram, m_min, m_max, 1.0f / kCompactScale);
+        }
+        else
+        {
+            addBlendRows<float>(firstRow, aligned, validity, m_histogram, m_min, m_max, 1.0f);
+        }
+    }
+}
+
+
+// Count a frame whose rows were added by addRows()
+void FrameAccumulator::countFrame()
+{
+    ++m_numFrames;
+}
+
+
+// Average of all added frames in 8-bit units, every pixel divided by its coverage
+void FrameAccumulator::average(cv::Mat& avg) const
+{
+    if (m_normalized)
+    {
+        avg = m_sum;
+        return;
+    }
+    if (m_compact)
+    {
+        divideByCoverage<int>(m_sum, m_coverage, kCompactScale, avg);
+    }
+    else
+    {
+        divideByCoverage<float>(m_sum, m_coverage, 1.0, avg);
+    }
+}
+
+
+// Sum downsampled by the given factor
+void FrameAccumulator::sumPreview(cv::Mat& preview, int factor) const
+{
+    cv::Size previewSize(std::max(1, m_sum.cols / factor), std::max(1, m_sum.rows / factor));
+    if (m_compact)
+    {
+        cv::Mat sum32f;
+        m_sum.convertTo(sum32f, CV_32FC3, 1.0 / kCompactScale);
+        cv::resize(sum32f, preview, previewSize, 0, 0, cv::INTER_AREA);
+    }
+    else
+    {
+        cv::resize(m_sum, preview, previewSize, 0, 0, cv::INTER_AREA);
+    }
+}
+
+
+// Blend of all added frames
+// median and trimmed mean are read from the histograms, max and min from the running extrema
+void FrameAccumulator::blend(cv::Mat& result) const
+{
+    if (m_blendMode == "min")
+    {
+        m_min.copyTo(result);
+        return;
+    }
+    if (m_blendMode == "max")
+    {
+        m_max.copyTo(result);
+        return;
+    }
+    if (!usesHistograms(m_blendMode))
+    {
+        average(result);
+        return;
+    }
+
+    bool median = m_blendMode == "median";
+    result.create(m_sum.size(), CV_32FC3);
+    for (int i = 0; i < result.rows; ++i)
+    {
+        const unsigned short* hist = m_histogram.ptr<unsigned short>(i);
+        float* dst = result.ptr<float>(i);
+
+        for (int k = 0; k < 3 * result.cols; ++k)
+        {
+            if (median)
+            {
+                dst[k] = histogramQuantile(hist + k * kHistogramBins, 0.5f);
+            }
+            else
+            {
+                dst[k] = histogramTrimmedMean(hist + k * kHistogramBins, m_trimFraction);
+            }
+        }
+    }
+}
+
+
+// Alpha mask from temporal luminance variance and mean displacement
+// alpha = min(1, max(sigma / sigmaScale, meanDisplacement / dispScale)), the statistics are weighted by coverage
+void FrameAccumulator::alphaMask(cv::Mat& alpha, double sigmaScale, double dispScale) const
+{
+    if (!m_motionStats || m_numFrames == 0)
+    {
+        zeroBuffer(alpha, m_sum.size(), CV_32FC1);
+        return;
+    }
+
+    cv::Mat avg;
+    average(avg);
+
+    alpha.create(m_sum.size(), CV_32FC1);
+
+    for (int i = 0; i < alpha.rows; ++i)
+    {
+        const cv::Vec3f* mean = avg.ptr<cv::Vec3f>(i);
+        const float* cov = m_coverage.ptr<float>(i);
+        const float* lumSq = m_lumSqSum.ptr<float>(i);
+        const float* disp = m_dispSum.ptr<float>(i);
+        float* dst = alpha.ptr<float>(i);
+
+        for (int j = 0; j < alpha.cols; ++j)
+        {
+            float invN = cov[j] > 0.0f ? 1.0f / cov[j] : 0.0f;
+            float meanLum = 0.114f * mean[j][0] + 0.587f * mean[j][1] + 0.299f * mean[j][2];
+            float variance = std::max(0.0f, lumSq[j] * invN - meanLum * meanLum);
+            float motion = std::max((float) (std::sqrt(variance) / sigmaScale), (float) (disp[j] * invN / dispScale));
+            dst[j] = std::min(1.0f, motion);
+        }
+    }
+}
+
+
+// Return number of accumulated frames
+int FrameAccumulator::numFrames() const
+{
+    return m_numFrames;
+}
+
+
+// Return true if motion statistics are collected
+bool FrameAccumulator::hasMotionStats() const
+{
+    return m_motionStats;
+}
+
+
+// Return size of the sum
+cv::Size FrameAccumulator::size() const
+{
+    return m_sum.size();
+}
+
+
+// Return true if name is a blend mode
+bool FrameAccumulator::isBlendMode(const std::string& name)
+{
+    return name == "mean" || name == "median" || name == "trimmed" || name == "max" || name == "min";
+}
+
+
+// Return true if the blend mode keeps a histogram per pixel
+bool FrameAccumulator::usesHistograms(const std::string& name)
+{
+    return name == "median" || name == "trimmed";
+}
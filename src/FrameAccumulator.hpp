@@ -0,0 +1,149 @@
+/**************************************
+ * Header file: FrameAccumulator.hpp
+ *
+ * Sums up aligned frames and collects
+ * per pixel motion statistics in the
+ * same pass
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_FRAMEACCUMULATOR_HPP
+#define VIDEOSTAB_FRAMEACCUMULATOR_HPP
+
+// C++ std libraries
+#include <memory>
+#include <string>
+
+// OpenCV libraries
+#include <opencv2/core/core.hpp>
+
+// User libraries
+#include "MappedFile.hpp"
+
+class FrameAccumulator
+{
+
+    public:
+
+        // Most frames a compact sum holds: full scale 16-bit samples summed up in 32-bit integers (reference frame included)
+        static const int kMaxCompactFrames = 32768;
+
+        // Empty constructor
+        FrameAccumulator();
+
+        // Select the blend mode (mean, median, trimmed, max or min), before init() or reset()
+        // @trimFraction: fraction of the samples the trimmed mean drops at each end
+        void setBlendMode(const std::string&, double = 0.1);
+
+        // Keep the floating point sum in a memory mapped file instead of the heap, before init() or reset()
+        // The file holds the sum as headerless BGR float rows, an empty path keeps the sum on the heap
+        void mapTo(const std::string&);
+
+        // Return true if the sum lives in a memory mapped file
+        bool isMapped() const;
+
+        // Divide the sum by the per pixel coverage in place, the mapped file then holds the average
+        // No frames can be added afterwards, average() returns a view of the sum
+        void normalize();
+
+        // Start a new sum with the reference frame (tile) data
+        // @compact:     integer sum of 16-bit fixed point samples, floating point sum otherwise
+        // @motionStats: collect luminance variance and displacement statistics for the alpha mask
+        void init(const cv::Mat&, bool, bool);
+
+        // Start a new empty sum of the given size
+        void reset(const cv::Size&, bool, bool);
+
+        // Start a new empty sum with the size, format and blend mode of another accumulator
+        void resetLike(const FrameAccumulator&);
+
+        // Add the sums and frame count of another accumulator of the same size and format
+        void merge(const FrameAccumulator&);
+
+        // Add an aligned frame (CV_32FC3 or CV_16UC3), the magnitude of its lookup displacements (CV_32FC1)
+        // and its coverage by the frame (CV_32FC1 in [0,1], empty: fully covered)
+        void add(const cv::Mat&, const cv::Mat& = cv::Mat(), const cv::Mat& = cv::Mat());
+
+        // Add aligned rows starting at the given row, the frame is counted by countFrame()
+        void addRows(int, const cv::Mat&, const cv::Mat& = cv::Mat(), const cv::Mat& = cv::Mat());
+
+        // Count a frame whose rows were added by addRows()
+        void countFrame();
+
+        // Average of all added frames, CV_32FC3 in 8-bit units, a view of the sum once normalized
+        // Every pixel is divided by its own coverage, pixels near the border average the frames that reached them
+        void average(cv::Mat&) const;
+
+        // Sum downsampled by the given factor (area average), CV_32FC3 in 8-bit units
+        void sumPreview(cv::Mat&, int) const;
+
+        // Blend of all added frames according to the blend mode, CV_32FC3 in 8-bit units
+        void blend(cv::Mat&) const;
+
+        // Alpha mask of motion regions, CV_32FC1 in [0,1]
+        // @sigmaScale: luminance standard deviation (8-bit units) that counts as full motion
+        // @dispScale:  mean lookup displacement (pixels) that counts as full motion
+        void alphaMask(cv::Mat&, double, double) const;
+
+        // Return number of accumulated frames (reference frame included)
+        int numFrames() const;
+
+        // Return true if motion statistics are collected
+        bool hasMotionStats() const;
+
+        // Return size of the sum
+        cv::Size size() const;
+
+        // Return true if name is a blend mode
+        static bool isBlendMode(const std::string&);
+
+        // Return true if the blend mode keeps a histogram per pixel (median, trimmed)
+        static bool usesHistograms(const std::string&);
+
+    private:
+
+        // Sum of aligned frames, CV_32FC3 or CV_32SC3 (compact)
+        cv::Mat m_sum;
+
+        // Path of the file the floating point sum is mapped to, empty: heap
+        std::string m_mappedPath;
+
+        // Mapping of the sum, shared by copies of the accumulator like the data of m_sum
+        std::shared_ptr<MappedFile> m_mapping;
+
+        // Per pixel sum of the coverage of the added frames, CV_32FC1
+        cv::Mat m_coverage;
+
+        // Sum of squared luminance, CV_32FC1 in 8-bit units
+        cv::Mat m_lumSqSum;
+
+        // Sum of lookup displacement magnitudes, CV_32FC1
+        cv::Mat m_dispSum;
+
+        // Per pixel and channel histograms of the 8-bit sample values, CV_16UC1 with cols * 3 * bins columns
+        cv::Mat m_histogram;
+
+        // Running minimum and maximum, CV_32FC3 in 8-bit units
+        cv::Mat m_min;
+        cv::Mat m_max;
+
+        // Blend mode
+        std::string m_blendMode;
+
+        // Fraction of samples the trimmed mean drops at each end
+        double m_trimFraction;
+
+        // Number of accumulated frames
+        int m_numFrames;
+
+        // Integer sum of fixed point samples
+        bool m_compact;
+
+        // Collect motion statistics
+        bool m_motionStats;
+
+        // The sum has been divided by the number of frames
+        bool m_normalized;
+};
+
+#endif // VIDEOSTAB_FRAMEACCUMULATOR_HPP
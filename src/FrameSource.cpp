@@ -0,0 +1,169 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: FrameSource.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+// User libraries
+#include "FrameSource.hpp"
+#include "AsyncFrameSource.hpp"
+#include "CroppedFrameSource.hpp"
+#include "MappedFrameSource.hpp"
+#include "ImageSequenceSource.hpp"
+#include "file_utils.h"
+
+// Open the frame source matching the file and parameters
+// @directory:              numbered images, decoded in parallel on the pool
+// @.y4m:                   memory mapped YUV4MPEG2 file
+// @params.rawWidth/Height: memory mapped headerless raw file
+// @otherwise:              video container decoded by cv::VideoCapture
+// With params.decodeAhead > 0 frames that need decoding get decoded on a dedicated thread
+// @crop: mapped files only convert the rectangle, decoded frames are cropped right after decoding
+std::unique_ptr<FrameSource> FrameSource::open(const std::string& filePath, const VideoProcessingParams& params, ThreadPool* pool, const cv::Rect& crop)
+{
+    std::unique_ptr<FrameSource> source;
+
+    // 16-bit frames are only kept by the compact (fixed point) pipeline
+    bool keep16Bit = params.compact;
+
+    std::string::size_type dot = filePath.rfind('.');
+    std::string ext = (dot == std::string::npos) ? "" : filePath.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    if (base::FileUtils::IsDir(filePath))
+    {
+        ImageSequenceSource* imageSequenceSource = new ImageSequenceSource(filePath, pool, keep16Bit);
+        source.reset(imageSequenceSource);
+        if (!imageSequenceSource->isOpened())
+        {
+            return std::unique_ptr<FrameSource>();
+        }
+        if (crop.area() > 0)
+        {
+            source.reset(new CroppedFrameSource(std::move(source), crop));
+        }
+        return source;
+    }
+    else if (params.rawWidth > 0 && params.rawHeight > 0)
+    {
+        RawFrameSource* rawFrameSource = new RawFrameSource(filePath, cv::Size(params.rawWidth, params.rawHeight), params.rawFormat, keep16Bit);
+        source.reset(rawFrameSource);
+        rawFrameSource->setCrop(crop);
+        return rawFrameSource->isOpened() ? std::move(source) : std::unique_ptr<FrameSource>();
+    }
+    else if (ext == "y4m")
+    {
+        Y4MFrameSource* y4mFrameSource = new Y4MFrameSource(filePath);
+        source.reset(y4mFrameSource);
+        if (!y4mFrameSource->isOpened())
+        {
+            return std::unique_ptr<FrameSource>();
+        }
+        y4mFrameSource->setCrop(crop);
+    }
+    else
+    {
+        VideoCaptureSource* videoCaptureSource = new VideoCaptureSource(filePath);
+        source.reset(videoCaptureSource);
+        if (!videoCaptureSource->isOpened())
+        {
+            return std::unique_ptr<FrameSource>();
+        }
+        if (crop.area() > 0)
+        {
+            source.reset(new CroppedFrameSource(std::move(source), crop));
+        }
+    }
+
+    if (params.decodeAhead > 0)
+    {
+        source.reset(new AsyncFrameSource(std::move(source), params.decodeAhead));
+    }
+
+    return source;
+}
+
+
+// Constructor: open the video file
+VideoCaptureSource::VideoCaptureSource(const std::string& filePath) : m_filePath(filePath), m_videoCapture(filePath), m_position(0), m_frameCount(0), m_frameRate(0.0)
+{
+    if (m_videoCapture.isOpened())
+    {
+        m_frameCount = m_videoCapture.get(cv::CAP_PROP_FRAME_COUNT);
+        m_frameRate = m_videoCapture.get(cv::CAP_PROP_FPS);
+    }
+}
+
+
+// Return true if the video could be opened
+bool VideoCaptureSource::isOpened() const
+{
+    return m_videoCapture.isOpened();
+}
+
+
+// Read the next frame
+bool VideoCaptureSource::read(cv::Mat& frame)
+{
+    if (!m_videoCapture.read(frame))
+    {
+        return false;
+    }
+    ++m_position;
+    return true;
+}
+
+
+// Jump to a certain frame number
+// Grabbing is slow but frame accurate, seeking by CAP_PROP_POS_FRAMES is not for most codecs
+bool VideoCaptureSource::seek(int pos)
+{
+    if (pos < m_position)
+    {
+        m_videoCapture.release();
+        if (!m_videoCapture.open(m_filePath))
+        {
+            return false;
+        }
+        m_position = 0;
+    }
+
+    while (m_position < pos)
+    {
+        if (!m_videoCapture.grab())
+        {
+            return false;
+        }
+        ++m_position;
+    }
+
+    return true;
+}
+
+
+// Return index of the next frame
+int VideoCaptureSource::position() const
+{
+    return m_position;
+}
+
+
+// Return number of frames of the video
+int VideoCaptureSource::frameCount() const
+{
+    return m_frameCount;
+}
+
+
+// Return frames per second of the video
+double VideoCaptureSource::frameRate() const
+{
+    return m_frameRate;
+}
@@ -0,0 +1,97 @@
+/**************************************
+ * Header file: FrameSource.hpp
+ *
+ * Sequential (and seekable) access to
+ * the frames of a video
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_FRAMESOURCE_HPP
+#define VIDEOSTAB_FRAMESOURCE_HPP
+
+// C++ std libraries
+#include <memory>
+#include <string>
+
+// OpenCV libraries
+#include <opencv2/core/core.hpp>
+#include <opencv2/videoio.hpp>
+
+// User libraries
+#include "VideoProcessingParams.hpp"
+
+class ThreadPool;
+
+class FrameSource
+{
+
+    public:
+
+        virtual ~FrameSource() {}
+
+        // Read the next frame, return false at the end of the video
+        virtual bool read(cv::Mat&) = 0;
+
+        // Position the source such that the next read returns the frame with the given index
+        virtual bool seek(int) = 0;
+
+        // Return index of the frame returned by the next read
+        virtual int position() const = 0;
+
+        // Return number of frames of the video
+        virtual int frameCount() const = 0;
+
+        // Return frames per second of the video, 0 if the source does not know it
+        virtual double frameRate() const { return 0.0; }
+
+        // Print source specific statistics
+        virtual void printStats() const {}
+
+        // Open the frame source matching the file and parameters, returns an empty pointer on failure
+        // Image sequences are decoded on the given pool, a non-empty rectangle crops every frame to it
+        static std::unique_ptr<FrameSource> open(const std::string&, const VideoProcessingParams&, ThreadPool*, const cv::Rect& = cv::Rect());
+};
+
+
+// Frame source decoding a video container with cv::VideoCapture
+class VideoCaptureSource : public FrameSource
+{
+
+    public:
+
+        // Constructor opens the video file
+        VideoCaptureSource(const std::string&);
+
+        // Return true if the video could be opened
+        bool isOpened() const;
+
+        virtual bool read(cv::Mat&);
+
+        // Seeking is done by grabbing frames, seeking backwards reopens the video
+        virtual bool seek(int);
+
+        virtual int position() const;
+
+        virtual int frameCount() const;
+
+        virtual double frameRate() const;
+
+    private:
+
+        // Video file path
+        std::string m_filePath;
+
+        // Video capture
+        cv::VideoCapture m_videoCapture;
+
+        // Index of the next frame
+        int m_position;
+
+        // Number of frames of the video
+        int m_frameCount;
+
+        // Frames per second of the video
+        double m_frameRate;
+};
+
+#endif // VIDEOSTAB_FRAMESOURCE_HPP
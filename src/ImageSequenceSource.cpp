@@ -0,0 +1,234 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: ImageSequenceSource.cpp
+ * ****************************/
+
+// C libraries
+#include <dirent.h>
+
+// C++ std libraries
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+// OpenCV libraries
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+// User libraries
+#include "ImageSequenceSource.hpp"
+
+namespace {
+
+// Image file extensions of a sequence
+bool isImageFile(const std::string& name)
+{
+    std::string::size_type dot = name.rfind('.');
+    if (dot == std::string::npos)
+    {
+        return false;
+    }
+    std::string ext = name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == "png" || ext == "jpg" || ext == "jpeg" || ext == "tif" || ext == "tiff" || ext == "bmp" || ext == "ppm" || ext == "pgm";
+}
+
+// Natural order: digit runs compare by value, such that frame9 < frame10
+bool naturalLess(const std::string& a, const std::string& b)
+{
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size())
+    {
+        if (std::isdigit(a[i]) && std::isdigit(b[j]))
+        {
+            size_t iEnd = a.find_first_not_of("0123456789", i);
+            size_t jEnd = b.find_first_not_of("0123456789", j);
+            iEnd = (iEnd == std::string::npos) ? a.size() : iEnd;
+            jEnd = (jEnd == std::string::npos) ? b.size() : jEnd;
+
+            // Compare without leading zeros: longer number is larger, then lexicographically
+            std::string na = a.substr(i, iEnd - i);
+            std::string nb = b.substr(j, jEnd - j);
+            na.erase(0, std::min(na.find_first_not_of('0'), na.size() - 1));
+            nb.erase(0, std::min(nb.find_first_not_of('0'), nb.size() - 1));
+            if (na.size() != nb.size())
+            {
+                return na.size() < nb.size();
+            }
+            if (na != nb)
+            {
+                return na < nb;
+            }
+            i = iEnd;
+            j = jEnd;
+        }
+        else
+        {
+            if (a[i] != b[j])
+            {
+                return a[i] < b[j];
+            }
+            ++i;
+            ++j;
+        }
+    }
+    return a.size() - i < b.size() - j;
+}
+
+} // namespace
+
+
+// Constructor: list and sort the images of the directory
+ImageSequenceSource::ImageSequenceSource(const std::string& dirPath, ThreadPool* pool, bool keep16Bit) : m_position(0), m_keep16Bit(keep16Bit), m_pool(pool), m_window(2 * pool->numThreads())
+{
+    DIR* dir = opendir(dirPath.c_str());
+    if (!dir)
+    {
+        std::cout << "Cannot open directory " << dirPath << std::endl;
+        return;
+    }
+
+    std::vector<std::string> names;
+    while (struct dirent* entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (isImageFile(name))
+        {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+
+    std::sort(names.begin(), names.end(), naturalLess);
+
+    std::string prefix = dirPath;
+    if (prefix[prefix.size() - 1] != '/')
+    {
+        prefix += '/';
+    }
+    for (int i = 0; i < names.size(); ++i)
+    {
+        m_files.push_back(prefix + names[i]);
+    }
+
+    std::cout << "image sequence of " << m_files.size() << " frames, decoded on " << m_pool->numThreads() << " threads" << std::endl;
+}
+
+
+// Return true if the directory contains at least one image
+bool ImageSequenceSource::isOpened() const
+{
+    return !m_files.empty();
+}
+
+
+// Read the next frame, the following frames are decoded in the background
+bool ImageSequenceSource::read(cv::Mat& frame)
+{
+    if (m_position >= frameCount())
+    {
+        return false;
+    }
+
+    prefetch();
+
+    std::map<int, std::shared_ptr<Decode> >::iterator it = m_pending.find(m_position);
+    frame = finish(*it->second);
+    m_pending.erase(it);
+
+    ++m_position;
+    return !frame.empty();
+}
+
+
+// Seeking only moves the frame index, decodes in flight before the new position are dropped
+// A dropped decode still finishes on the pool, its task holds the only reference
+bool ImageSequenceSource::seek(int pos)
+{
+    if (pos < 0 || pos > frameCount())
+    {
+        return false;
+    }
+    m_pending.erase(m_pending.begin(), m_pending.lower_bound(pos));
+    m_position = pos;
+    return true;
+}
+
+
+// Return index of the next frame
+int ImageSequenceSource::position() const
+{
+    return m_position;
+}
+
+
+// Return number of frames
+int ImageSequenceSource::frameCount() const
+{
+    return m_files.size();
+}
+
+
+// Return the frame with the given index, O(1) and independent of the read position
+bool ImageSequenceSource::frameAt(int index, cv::Mat& frame)
+{
+    if (index < 0 || index >= frameCount())
+    {
+        return false;
+    }
+    std::map<int, std::shared_ptr<Decode> >::iterator it = m_pending.find(index);
+    frame = (it != m_pending.end()) ? finish(*it->second) : decode(m_files[index], m_keep16Bit);
+    return !frame.empty();
+}
+
+
+// Wait for a decode, the waiting thread decodes the image itself if no worker has started it yet
+cv::Mat ImageSequenceSource::finish(Decode& pending)
+{
+    m_pool->wait(pending.task);
+    return pending.frame;
+}
+
+
+// Submit decodes of the frames within the window following the current position
+void ImageSequenceSource::prefetch()
+{
+    int end = std::min(m_position + m_window, frameCount());
+    for (int idx = m_position; idx < end; ++idx)
+    {
+        if (m_pending.count(idx))
+        {
+            continue;
+        }
+        std::shared_ptr<Decode> pending = std::make_shared<Decode>();
+        std::string filePath = m_files[idx];
+        bool keep16Bit = m_keep16Bit;
+        m_pending[idx] = pending;
+        m_pool->submit(pending->task, [pending, filePath, keep16Bit]() { pending->frame = decode(filePath, keep16Bit); });
+    }
+}
+
+
+// Decode a single image to a BGR frame with 8 bit (or 16 bit) per channel
+cv::Mat ImageSequenceSource::decode(const std::string& filePath, bool keep16Bit)
+{
+    cv::Mat image = cv::imread(filePath, cv::IMREAD_ANYDEPTH | cv::IMREAD_COLOR);
+    if (image.empty())
+    {
+        std::cout << "Cannot read image " << filePath << std::endl;
+        return image;
+    }
+
+    if (image.depth() == CV_16U && !keep16Bit)
+    {
+        image.convertTo(image, CV_8UC3, 1.0 / 256);
+    }
+    else if (image.depth() != CV_8U && image.depth() != CV_16U)
+    {
+        image.convertTo(image, CV_8UC3);
+    }
+    return image;
+}
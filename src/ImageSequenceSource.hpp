@@ -0,0 +1,82 @@
+/**************************************
+ * Header file: ImageSequenceSource.hpp
+ *
+ * Frame source for a directory of
+ * numbered images, decoded in parallel
+ * on the pool of the session
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_IMAGESEQUENCESOURCE_HPP
+#define VIDEOSTAB_IMAGESEQUENCESOURCE_HPP
+
+// C++ std libraries
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// User libraries
+#include "FrameSource.hpp"
+#include "ThreadPool.hpp"
+
+class ImageSequenceSource : public FrameSource
+{
+
+    public:
+
+        // Constructor lists the images of the directory, takes the pool decoding the images and whether 16-bit images are kept
+        ImageSequenceSource(const std::string&, ThreadPool*, bool);
+
+        // Return true if the directory contains at least one image
+        bool isOpened() const;
+
+        virtual bool read(cv::Mat&);
+
+        virtual bool seek(int);
+
+        virtual int position() const;
+
+        virtual int frameCount() const;
+
+        // Return the frame with the given index
+        bool frameAt(int, cv::Mat&);
+
+    private:
+
+        // Decode of a single image in flight, the task owns a reference so dropping it early is safe
+        struct Decode
+        {
+            TaskGroup task;
+            cv::Mat frame;
+        };
+
+        // Wait for a decode and return its frame
+        cv::Mat finish(Decode&);
+
+        // Submit decodes of the frames following the current position
+        void prefetch();
+
+        // Decode a single image (file path, keep 16 bit) to a BGR frame
+        static cv::Mat decode(const std::string&, bool);
+
+        // Image files sorted by frame number
+        std::vector<std::string> m_files;
+
+        // Index of the next frame
+        int m_position;
+
+        // Hand out 16-bit images without reducing them to 8 bit
+        bool m_keep16Bit;
+
+        // Pool decoding the images, shared with the other stages
+        ThreadPool* m_pool;
+
+        // Number of frames decoded ahead
+        int m_window;
+
+        // Decodes in flight by frame index
+        std::map<int, std::shared_ptr<Decode> > m_pending;
+};
+
+#endif // VIDEOSTAB_IMAGESEQUENCESOURCE_HPP
@@ -0,0 +1,142 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: MappedFile.cpp
+ * ****************************/
+
+// C libraries
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// C++ std libraries
+#include <iostream>
+
+// User libraries
+#include "MappedFile.hpp"
+
+// Constructor
+MappedFile::MappedFile() : m_data(0), m_size(0), m_fd(-1)
+{
+}
+
+
+// Destructor
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+
+// Map a whole file read-only
+bool MappedFile::openReadOnly(const std::string& filePath)
+{
+    close();
+
+    m_fd = ::open(filePath.c_str(), O_RDONLY);
+    if (m_fd < 0)
+    {
+        std::cout << "Cannot open file " << filePath << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(m_fd, &info) != 0 || info.st_size == 0)
+    {
+        std::cout << "Cannot map empty file " << filePath << std::endl;
+        close();
+        return false;
+    }
+
+    void* data = mmap(0, info.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        std::cout << "Cannot map file " << filePath << std::endl;
+        close();
+        return false;
+    }
+
+    m_data = static_cast<unsigned char*>(data);
+    m_size = info.st_size;
+
+    // Frames are mostly read front to back
+    madvise(m_data, m_size, MADV_SEQUENTIAL);
+
+    return true;
+}
+
+
+// Create a file of the given size and map it read-write
+// Pages are only backed by disk blocks once written, so a sparse sum costs no disk space up front
+bool MappedFile::createReadWrite(const std::string& filePath, size_t size)
+{
+    close();
+
+    m_fd = ::open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0)
+    {
+        std::cout << "Cannot create file " << filePath << std::endl;
+        return false;
+    }
+
+    if (size == 0 || ftruncate(m_fd, size) != 0)
+    {
+        std::cout << "Cannot resize file " << filePath << " to " << size << " bytes" << std::endl;
+        close();
+        return false;
+    }
+
+    void* data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        std::cout << "Cannot map file " << filePath << std::endl;
+        close();
+        return false;
+    }
+
+    m_data = static_cast<unsigned char*>(data);
+    m_size = size;
+
+    return true;
+}
+
+
+// Unmap the file
+void MappedFile::close()
+{
+    if (m_data)
+    {
+        munmap(m_data, m_size);
+        m_data = 0;
+        m_size = 0;
+    }
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+
+// Return true if a file is mapped
+bool MappedFile::isOpen() const
+{
+    return m_data != 0;
+}
+
+
+// Return pointer to the first byte of the mapping
+unsigned char* MappedFile::data() const
+{
+    return m_data;
+}
+
+
+// Return size of the mapping in bytes
+size_t MappedFile::size() const
+{
+    return m_size;
+}
@@ -0,0 +1,61 @@
+/**************************************
+ * Header file: MappedFile.hpp
+ *
+ * Memory mapped file, read-only input
+ * or read-write output
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_MAPPEDFILE_HPP
+#define VIDEOSTAB_MAPPEDFILE_HPP
+
+// C++ std libraries
+#include <cstddef>
+#include <string>
+
+class MappedFile
+{
+
+    public:
+
+        // Empty constructor
+        MappedFile();
+
+        // Destructor unmaps the file
+        ~MappedFile();
+
+        // Map a whole file read-only
+        bool openReadOnly(const std::string&);
+
+        // Create (or truncate) a file of the given size and map it read-write, the contents start zeroed
+        bool createReadWrite(const std::string&, size_t);
+
+        // Unmap the file
+        void close();
+
+        // Return true if a file is mapped
+        bool isOpen() const;
+
+        // Return pointer to the first byte of the mapping
+        unsigned char* data() const;
+
+        // Return size of the mapping in bytes
+        size_t size() const;
+
+    private:
+
+        // Not copyable, the mapping is owned by one object
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+
+        // Start of the mapping
+        unsigned char* m_data;
+
+        // Size of the mapping in bytes
+        size_t m_size;
+
+        // File descriptor of the mapped file
+        int m_fd;
+};
+
+#endif // VIDEOSTAB_MAPPEDFILE_HPP
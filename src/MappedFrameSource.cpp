@@ -0,0 +1,323 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: MappedFrameSource.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+// OpenCV libraries
+#include <opencv2/imgproc/imgproc.hpp>
+
+// User libraries
+#include "MappedFrameSource.hpp"
+
+// Constructor
+MappedFrameSource::MappedFrameSource() : m_viewRows(0), m_viewCols(0), m_viewType(CV_8UC1), m_position(0)
+{
+}
+
+
+// Return true if the file is mapped and contains at least one frame
+bool MappedFrameSource::isOpened() const
+{
+    return m_file.isOpen() && !m_frameOffsets.empty();
+}
+
+
+// Read the next frame
+bool MappedFrameSource::read(cv::Mat& frame)
+{
+    if (!frameAt(m_position, frame))
+    {
+        return false;
+    }
+    ++m_position;
+    return true;
+}
+
+
+// Seeking only moves the frame index
+bool MappedFrameSource::seek(int pos)
+{
+    if (pos < 0 || pos > frameCount())
+    {
+        return false;
+    }
+    m_position = pos;
+    return true;
+}
+
+
+// Return index of the next frame
+int MappedFrameSource::position() const
+{
+    return m_position;
+}
+
+
+// Return number of frames of the file
+int MappedFrameSource::frameCount() const
+{
+    return m_frameOffsets.size();
+}
+
+
+// Zero-copy view of the raw data of a frame
+cv::Mat MappedFrameSource::view(int index) const
+{
+    if (index < 0 || index >= frameCount())
+    {
+        return cv::Mat();
+    }
+    return cv::Mat(m_viewRows, m_viewCols, m_viewType, m_file.data() + m_frameOffsets[index]);
+}
+
+
+// Return the frame with the given index as BGR frame
+bool MappedFrameSource::frameAt(int index, cv::Mat& frame) const
+{
+    cv::Mat rawView = view(index);
+    if (rawView.empty())
+    {
+        return false;
+    }
+
+    if (m_crop.area() == 0)
+    {
+        convert(rawView, frame);
+    }
+    else if (interleaved())
+    {
+        // Only the pages of the rectangle are touched
+        convert(rawView(m_crop & cv::Rect(0, 0, rawView.cols, rawView.rows)), frame);
+    }
+    else
+    {
+        // Planar formats are converted in full
+        cv::Mat full;
+        convert(rawView, full);
+        frame = full(m_crop & cv::Rect(0, 0, full.cols, full.rows)).clone();
+    }
+    return true;
+}
+
+
+// Hand out only the given rectangle of every frame
+void MappedFrameSource::setCrop(const cv::Rect& crop)
+{
+    m_crop = crop;
+}
+
+
+// Constructor: parse the stream header and index all frames
+// Header: YUV4MPEG2 W<width> H<height> [F.. I.. A.. C<chroma> X..]
+// Frame: FRAME [params]\n <planar Y, U, V data>
+Y4MFrameSource::Y4MFrameSource(const std::string& filePath) : m_chroma(CHROMA_420), m_width(0), m_height(0)
+{
+    if (!m_file.openReadOnly(filePath))
+    {
+        return;
+    }
+
+    const char* data = reinterpret_cast<const char*>(m_file.data());
+    size_t size = m_file.size();
+
+    const char* headerEnd = static_cast<const char*>(std::memchr(data, '\n', size));
+    if (size < 9 || std::strncmp(data, "YUV4MPEG2", 9) != 0 || !headerEnd)
+    {
+        std::cout << "Not a Y4M file: " << filePath << std::endl;
+        return;
+    }
+
+    std::istringstream header(std::string(data + 9, headerEnd));
+    std::string token;
+    while (header >> token)
+    {
+        if (token[0] == 'W')
+        {
+            m_width = std::atoi(token.c_str() + 1);
+        }
+        else if (token[0] == 'H')
+        {
+            m_height = std::atoi(token.c_str() + 1);
+        }
+        else if (token[0] == 'C')
+        {
+            std::string chroma = token.substr(1);
+            // 8-bit 4:2:0 with any chroma siting, bit depth suffixes (420p10, 420p12, ...) are rejected
+            if (chroma == "420" || chroma == "420jpeg" || chroma == "420mpeg2" || chroma == "420paldv")
+            {
+                m_chroma = CHROMA_420;
+            }
+            else if (chroma == "444")
+            {
+                m_chroma = CHROMA_444;
+            }
+            else if (chroma == "mono")
+            {
+                m_chroma = CHROMA_MONO;
+            }
+            else
+            {
+                std::cout << "Unsupported Y4M chroma format " << chroma << std::endl;
+                return;
+            }
+        }
+    }
+
+    if (m_width <= 0 || m_height <= 0 || (m_chroma == CHROMA_420 && (m_width % 2 != 0 || m_height % 2 != 0)))
+    {
+        std::cout << "Unsupported Y4M frame size " << m_width << "x" << m_height << std::endl;
+        return;
+    }
+
+    // Raw frame view: planes stacked on top of each other
+    m_viewCols = m_width;
+    m_viewType = CV_8UC1;
+    if (m_chroma == CHROMA_420)
+    {
+        m_viewRows = m_height * 3 / 2;
+    }
+    else if (m_chroma == CHROMA_444)
+    {
+        m_viewRows = m_height * 3;
+    }
+    else
+    {
+        m_viewRows = m_height;
+    }
+    size_t frameSize = (size_t) m_viewRows * m_viewCols;
+
+    // Index all frames, only the frame headers are touched
+    size_t pos = headerEnd - data + 1;
+    while (pos + 5 <= size && std::strncmp(data + pos, "FRAME", 5) == 0)
+    {
+        const char* frameHeaderEnd = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+        if (!frameHeaderEnd)
+        {
+            break;
+        }
+        size_t offset = frameHeaderEnd - data + 1;
+        if (offset + frameSize > size)
+        {
+            break;
+        }
+        m_frameOffsets.push_back(offset);
+        pos = offset + frameSize;
+    }
+
+    std::cout << "Y4M " << m_width << "x" << m_height << ", " << m_frameOffsets.size() << " frames mapped" << std::endl;
+}
+
+
+// Convert planar YUV to BGR
+void Y4MFrameSource::convert(const cv::Mat& rawView, cv::Mat& frame) const
+{
+    if (m_chroma == CHROMA_420)
+    {
+        cv::cvtColor(rawView, frame, cv::COLOR_YUV2BGR_I420);
+    }
+    else if (m_chroma == CHROMA_444)
+    {
+        std::vector<cv::Mat> planes;
+        planes.push_back(rawView.rowRange(0, m_height));
+        planes.push_back(rawView.rowRange(m_height, 2 * m_height));
+        planes.push_back(rawView.rowRange(2 * m_height, 3 * m_height));
+        cv::Mat yuv;
+        cv::merge(planes, yuv);
+        cv::cvtColor(yuv, frame, cv::COLOR_YUV2BGR);
+    }
+    else
+    {
+        cv::cvtColor(rawView, frame, cv::COLOR_GRAY2BGR);
+    }
+}
+
+
+// Constructor: map the file, frames follow each other without headers
+RawFrameSource::RawFrameSource(const std::string& filePath, cv::Size frameSize, const std::string& format, bool keep16Bit) : m_format(format), m_keep16Bit(keep16Bit)
+{
+    m_viewRows = frameSize.height;
+    m_viewCols = frameSize.width;
+
+    if (format == "bgr24" || format == "rgb24")
+    {
+        m_viewType = CV_8UC3;
+    }
+    else if (format == "gray8")
+    {
+        m_viewType = CV_8UC1;
+    }
+    else if (format == "i420" && frameSize.width % 2 == 0 && frameSize.height % 2 == 0)
+    {
+        m_viewRows = frameSize.height * 3 / 2;
+        m_viewType = CV_8UC1;
+    }
+    else if (format == "bgr48")
+    {
+        m_viewType = CV_16UC3;
+    }
+    else
+    {
+        std::cout << "Unsupported raw format " << format << " for frame size " << frameSize.width << "x" << frameSize.height << std::endl;
+        return;
+    }
+
+    if (!m_file.openReadOnly(filePath) || m_viewRows <= 0 || m_viewCols <= 0)
+    {
+        return;
+    }
+
+    size_t bytesPerPixel = (m_viewType == CV_8UC3) ? 3 : (m_viewType == CV_16UC3) ? 6 : 1;
+    size_t frameBytes = (size_t) m_viewRows * m_viewCols * bytesPerPixel;
+    for (size_t offset = 0; offset + frameBytes <= m_file.size(); offset += frameBytes)
+    {
+        m_frameOffsets.push_back(offset);
+    }
+
+    std::cout << "raw " << format << " " << frameSize.width << "x" << frameSize.height << ", " << m_frameOffsets.size() << " frames mapped" << std::endl;
+}
+
+
+// Convert raw pixels to BGR, bgr24 (and bgr48 if 16-bit frames are kept) are handed out without copy
+void RawFrameSource::convert(const cv::Mat& rawView, cv::Mat& frame) const
+{
+    if (m_format == "bgr24")
+    {
+        frame = rawView;
+    }
+    else if (m_format == "rgb24")
+    {
+        cv::cvtColor(rawView, frame, cv::COLOR_RGB2BGR);
+    }
+    else if (m_format == "gray8")
+    {
+        cv::cvtColor(rawView, frame, cv::COLOR_GRAY2BGR);
+    }
+    else if (m_format == "i420")
+    {
+        cv::cvtColor(rawView, frame, cv::COLOR_YUV2BGR_I420);
+    }
+    else if (m_keep16Bit)
+    {
+        frame = rawView;
+    }
+    else
+    {
+        rawView.convertTo(frame, CV_8UC3, 1.0 / 256);
+    }
+}
+
+
+// All formats but i420 are interleaved
+bool RawFrameSource::interleaved() const
+{
+    return m_format != "i420";
+}
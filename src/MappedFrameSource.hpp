@@ -0,0 +1,128 @@
+/**************************************
+ * Header file: MappedFrameSource.hpp
+ *
+ * Frame sources for uncompressed Y4M and
+ * raw files, frames are views into a
+ * memory mapping of the file
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_MAPPEDFRAMESOURCE_HPP
+#define VIDEOSTAB_MAPPEDFRAMESOURCE_HPP
+
+// C++ std libraries
+#include <string>
+#include <vector>
+
+// User libraries
+#include "FrameSource.hpp"
+#include "MappedFile.hpp"
+
+// Common base of mapped frame sources, random access to a frame is O(1)
+class MappedFrameSource : public FrameSource
+{
+
+    public:
+
+        // Constructor
+        MappedFrameSource();
+
+        // Return true if the file is mapped and contains at least one frame
+        bool isOpened() const;
+
+        virtual bool read(cv::Mat&);
+
+        virtual bool seek(int);
+
+        virtual int position() const;
+
+        virtual int frameCount() const;
+
+        // Zero-copy view of the raw data of a frame, the view is read-only and valid as long as the source
+        cv::Mat view(int) const;
+
+        // Return the frame with the given index as BGR frame
+        bool frameAt(int, cv::Mat&) const;
+
+        // Hand out only the given rectangle of every frame, an empty rectangle hands out full frames
+        void setCrop(const cv::Rect&);
+
+    protected:
+
+        // Convert a raw frame view to a BGR frame, the result may be the view itself
+        virtual void convert(const cv::Mat&, cv::Mat&) const = 0;
+
+        // Return true if raw pixels are interleaved, so a rectangle of the raw view converts to the same rectangle of the frame
+        virtual bool interleaved() const { return false; }
+
+        // Mapped file
+        MappedFile m_file;
+
+        // Byte offset of every frame in the file
+        std::vector<size_t> m_frameOffsets;
+
+        // Layout of a raw frame view
+        int m_viewRows;
+        int m_viewCols;
+        int m_viewType;
+
+        // Index of the next frame
+        int m_position;
+
+        // Rectangle handed out, empty for full frames
+        cv::Rect m_crop;
+};
+
+
+// YUV4MPEG2 file with 8-bit 4:2:0, 4:4:4 or mono frames
+class Y4MFrameSource : public MappedFrameSource
+{
+
+    public:
+
+        // Constructor maps the file and indexes all frames
+        Y4MFrameSource(const std::string&);
+
+    protected:
+
+        virtual void convert(const cv::Mat&, cv::Mat&) const;
+
+    private:
+
+        // Chroma subsampling of the file
+        enum Chroma { CHROMA_420, CHROMA_444, CHROMA_MONO };
+        Chroma m_chroma;
+
+        // Frame size
+        int m_width;
+        int m_height;
+};
+
+
+// Headerless file of equally sized frames
+// Formats: bgr24, rgb24, gray8, i420 and bgr48 (16-bit little endian)
+class RawFrameSource : public MappedFrameSource
+{
+
+    public:
+
+        // Constructor maps the file, takes frame size, format and whether 16-bit frames are kept
+        RawFrameSource(const std::string&, cv::Size, const std::string&, bool);
+
+    protected:
+
+        virtual void convert(const cv::Mat&, cv::Mat&) const;
+
+        // All formats but i420 are interleaved
+        virtual bool interleaved() const;
+
+    private:
+
+        // Pixel format
+        std::string m_format;
+
+        // Hand out 16-bit frames without reducing them to 8 bit
+        bool m_keep16Bit;
+};
+
+#endif // VIDEOSTAB_MAPPEDFRAMESOURCE_HPP
@@ -0,0 +1,317 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: MemoryStats.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+// User libraries
+#include "MemoryStats.hpp"
+
+namespace
+{
+    // Bytes to MB
+    double toMB(long long bytes)
+    {
+        return bytes / (1024.0 * 1024.0);
+    }
+}
+
+// Constructor
+CountingMatAllocator::CountingMatAllocator(const cv::MatAllocator* base) : m_base(base)
+{
+}
+
+
+// Allocate a buffer through the wrapped allocator
+// Buffers wrapping user data are not counted
+cv::UMatData* CountingMatAllocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, MatAccessFlag flags, cv::UMatUsageFlags usageFlags) const
+{
+    cv::UMatData* u = m_base->allocate(dims, sizes, type, data0, step, flags, usageFlags);
+    if (u)
+    {
+        // Releases of the buffer come back to this allocator
+        u->currAllocator = this;
+        if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+        {
+            MemoryStats::instance().recordAllocation(u->size);
+        }
+    }
+    return u;
+}
+
+
+// Allocate host memory of an existing buffer
+bool CountingMatAllocator::allocate(cv::UMatData* u, MatAccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const
+{
+    return m_base->allocate(u, accessFlags, usageFlags);
+}
+
+
+// Count the released buffer and free it
+void CountingMatAllocator::deallocate(cv::UMatData* u) const
+{
+    if (!u)
+    {
+        return;
+    }
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+    {
+        MemoryStats::instance().recordDeallocation(u->size);
+    }
+    u->currAllocator = m_base;
+    m_base->deallocate(u);
+}
+
+
+// The statistics of the process
+// Never destroyed, buffers may be released after the exit handlers ran
+MemoryStats& MemoryStats::instance()
+{
+    static MemoryStats* stats = new MemoryStats();
+    return *stats;
+}
+
+
+// Constructor
+MemoryStats::MemoryStats() : m_numStages(1), m_currentStage(0), m_liveBytes(0), m_peakLiveBytes(0), m_enabled(false), m_samplerDone(false)
+{
+    m_stages[0].name = "other";
+    m_stages[0].numEntries = 1;
+}
+
+
+// Install the counting allocator, start sampling and register the summary
+void MemoryStats::enable()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_enabled)
+    {
+        return;
+    }
+    m_enabled = true;
+
+    // Never destroyed, it frees the buffers still alive at exit
+    static CountingMatAllocator* allocator = new CountingMatAllocator(cv::Mat::getStdAllocator());
+    cv::Mat::setDefaultAllocator(allocator);
+
+    m_sampler = std::thread(&MemoryStats::samplerLoop, this);
+    std::atexit(&MemoryStats::printSummaryAtExit);
+}
+
+
+// Return true if the statistics are collected
+bool MemoryStats::enabled() const
+{
+    return m_enabled;
+}
+
+
+// Make the named stage current
+// A stage entered again keeps counting into the same entry
+int MemoryStats::enterStage(const std::string& name)
+{
+    int index = -1;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (int i = 0; i < m_numStages; ++i)
+        {
+            if (m_stages[i].name == name)
+            {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0)
+        {
+            if (m_numStages == kMaxStages)
+            {
+                std::cout << "memory stats: too many stages, " << name << " is counted as " << m_stages[0].name << std::endl;
+                index = 0;
+            }
+            else
+            {
+                index = m_numStages++;
+                m_stages[index].name = name;
+            }
+        }
+        m_stages[index].numEntries++;
+    }
+
+    raisePeak(m_stages[index].peakLiveBytes, m_liveBytes);
+    int previous = m_currentStage.exchange(index);
+    sampleRss();
+    return previous;
+}
+
+
+// Make the stage with the given index current again
+void MemoryStats::restoreStage(int index)
+{
+    sampleRss();
+    m_currentStage = index;
+    raisePeak(m_stages[index].peakLiveBytes, m_liveBytes);
+}
+
+
+// Count an allocation of the current stage
+void MemoryStats::recordAllocation(size_t bytes)
+{
+    Stage& stage = m_stages[m_currentStage];
+    stage.numAllocations++;
+    stage.bytesAllocated += bytes;
+
+    long long live = (m_liveBytes += bytes);
+    raisePeak(stage.peakLiveBytes, live);
+    raisePeak(m_peakLiveBytes, live);
+}
+
+
+// Count a release of the current stage
+void MemoryStats::recordDeallocation(size_t bytes)
+{
+    m_stages[m_currentStage].bytesFreed += bytes;
+    m_liveBytes -= bytes;
+}
+
+
+// Print the per stage summary
+void MemoryStats::printSummary()
+{
+    sampleRss();
+
+    long long rssKb = 0;
+    long long hwmKb = 0;
+    readResidentSetSize(rssKb, hwmKb);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::cout << "memory per stage (cv::Mat buffers in MB, peak RSS sampled every 10 ms):" << std::endl;
+    std::cout << std::setw(16) << "stage" << std::setw(8) << "entries" << std::setw(12) << "allocs" << std::setw(12) << "allocated"
+              << std::setw(12) << "freed" << std::setw(12) << "peak live" << std::setw(12) << "peak RSS" << std::endl;
+
+    std::cout << std::fixed << std::setprecision(1);
+    for (int i = 0; i < m_numStages; ++i)
+    {
+        const Stage& stage = m_stages[i];
+        if (stage.numAllocations == 0 && stage.peakRssKb == 0)
+        {
+            continue;
+        }
+        std::cout << std::setw(16) << stage.name << std::setw(8) << stage.numEntries << std::setw(12) << stage.numAllocations
+                  << std::setw(12) << toMB(stage.bytesAllocated) << std::setw(12) << toMB(stage.bytesFreed)
+                  << std::setw(12) << toMB(stage.peakLiveBytes) << std::setw(12) << stage.peakRssKb / 1024.0 << std::endl;
+    }
+    std::cout << "live at exit: " << toMB(m_liveBytes) << " MB, peak live: " << toMB(m_peakLiveBytes) << " MB, "
+              << "RSS: " << rssKb / 1024.0 << " MB, peak RSS (VmHWM): " << hwmKb / 1024.0 << " MB" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+}
+
+
+// Resident set size and its peak from /proc/self/status
+void MemoryStats::readResidentSetSize(long long& rssKb, long long& hwmKb)
+{
+    rssKb = 0;
+    hwmKb = 0;
+
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+        {
+            rssKb = std::atoll(line.c_str() + 6);
+        }
+        else if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            hwmKb = std::atoll(line.c_str() + 6);
+        }
+    }
+}
+
+
+// Sample the resident set size into the current stage
+void MemoryStats::sampleRss()
+{
+    long long rssKb = 0;
+    long long hwmKb = 0;
+    readResidentSetSize(rssKb, hwmKb);
+    raisePeak(m_stages[m_currentStage].peakRssKb, rssKb);
+}
+
+
+// Sampler thread main loop
+void MemoryStats::samplerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_samplerDone)
+    {
+        m_stopSampling.wait_for(lock, std::chrono::milliseconds(10));
+        lock.unlock();
+        sampleRss();
+        lock.lock();
+    }
+}
+
+
+// Stop the sampler thread
+void MemoryStats::stopSampler()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_samplerDone = true;
+    }
+    m_stopSampling.notify_all();
+    if (m_sampler.joinable())
+    {
+        m_sampler.join();
+    }
+}
+
+
+// Raise an atomic peak to the given value
+void MemoryStats::raisePeak(std::atomic<long long>& peak, long long value)
+{
+    long long current = peak;
+    while (value > current && !peak.compare_exchange_weak(current, value))
+    {
+    }
+}
+
+
+// Exit handler printing the summary
+void MemoryStats::printSummaryAtExit()
+{
+    MemoryStats& stats = instance();
+    stats.stopSampler();
+    stats.printSummary();
+}
+
+
+// Enter the named stage
+MemoryStage::MemoryStage(const std::string& name) : m_previous(-1)
+{
+    MemoryStats& stats = MemoryStats::instance();
+    if (stats.enabled())
+    {
+        m_previous = stats.enterStage(name);
+    }
+}
+
+
+// Leave the stage
+MemoryStage::~MemoryStage()
+{
+    if (m_previous >= 0)
+    {
+        MemoryStats::instance().restoreStage(m_previous);
+    }
+}
@@ -0,0 +1,180 @@
+/**************************************
+ * Header file: MemoryStats.hpp
+ *
+ * Allocation and peak RSS accounting
+ * per pipeline stage
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_MEMORYSTATS_HPP
+#define VIDEOSTAB_MEMORYSTATS_HPP
+
+// C++ std libraries
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// OpenCV libraries
+#include <opencv2/core/core.hpp>
+
+// Access flags of cv::MatAllocator, an enum since OpenCV 4
+#if CV_VERSION_MAJOR >= 4
+typedef cv::AccessFlag MatAccessFlag;
+#else
+typedef int MatAccessFlag;
+#endif
+
+// cv::Mat allocator counting the bytes of every buffer it hands out, the buffers come from the wrapped allocator
+// Buffers are tagged with this allocator, so they are counted again when they are released
+class CountingMatAllocator : public cv::MatAllocator
+{
+
+    public:
+
+        // Constructor wrapping the given allocator
+        explicit CountingMatAllocator(const cv::MatAllocator*);
+
+        // Allocate a buffer through the wrapped allocator and count it
+        cv::UMatData* allocate(int, const int*, int, void*, size_t*, MatAccessFlag, cv::UMatUsageFlags) const override;
+
+        // Allocate host memory of an existing buffer through the wrapped allocator
+        bool allocate(cv::UMatData*, MatAccessFlag, cv::UMatUsageFlags) const override;
+
+        // Count the released buffer and free it through the wrapped allocator
+        void deallocate(cv::UMatData*) const override;
+
+    private:
+
+        // Allocator owning the memory
+        const cv::MatAllocator* m_base;
+};
+
+
+// Process wide memory statistics
+// cv::Mat allocations are attributed to the current stage: bytes and number of allocations, bytes freed
+// and the peak of the live bytes while the stage is active. The resident set size is sampled
+// from /proc/self/status on every stage change and every 10 ms, the summary is printed at exit.
+// Stages are process wide, concurrent jobs of a batch share the stage entered last.
+class MemoryStats
+{
+
+    public:
+
+        // The statistics of the process
+        static MemoryStats& instance();
+
+        // Install the counting allocator, start sampling and print the summary at exit, idempotent
+        void enable();
+
+        // Return true if the statistics are collected
+        bool enabled() const;
+
+        // Make the named stage current, return the index of the previous stage
+        int enterStage(const std::string&);
+
+        // Make the stage with the given index current again
+        void restoreStage(int);
+
+        // Count an allocation of the current stage
+        void recordAllocation(size_t);
+
+        // Count a release of the current stage
+        void recordDeallocation(size_t);
+
+        // Print the per stage summary
+        void printSummary();
+
+        // Resident set size and its peak (VmRSS, VmHWM) of the process in kB, 0 if unknown
+        static void readResidentSetSize(long long&, long long&);
+
+    private:
+
+        // Maximum number of distinct stages
+        static const int kMaxStages = 32;
+
+        // Counters of a stage
+        struct Stage
+        {
+            Stage() : numAllocations(0), bytesAllocated(0), bytesFreed(0), peakLiveBytes(0), peakRssKb(0), numEntries(0) {}
+
+            std::atomic<long long> numAllocations;
+            std::atomic<long long> bytesAllocated;
+            std::atomic<long long> bytesFreed;
+            std::atomic<long long> peakLiveBytes;
+            std::atomic<long long> peakRssKb;
+            int numEntries;
+            std::string name;
+        };
+
+        // Constructor, stage 0 collects everything outside of named stages
+        MemoryStats();
+
+        // Sample the resident set size into the current stage
+        void sampleRss();
+
+        // Sampler thread main loop
+        void samplerLoop();
+
+        // Stop the sampler thread
+        void stopSampler();
+
+        // Raise an atomic peak to the given value
+        static void raisePeak(std::atomic<long long>&, long long);
+
+        // Exit handler printing the summary
+        static void printSummaryAtExit();
+
+        // Stages, the first m_numStages are in use
+        Stage m_stages[kMaxStages];
+
+        // Number of stages in use
+        int m_numStages;
+
+        // Index of the current stage
+        std::atomic<int> m_currentStage;
+
+        // Bytes of all live cv::Mat buffers
+        std::atomic<long long> m_liveBytes;
+
+        // Peak of the live bytes over the whole run
+        std::atomic<long long> m_peakLiveBytes;
+
+        // True once enabled
+        std::atomic<bool> m_enabled;
+
+        // Protects the stage names and the sampler state
+        std::mutex m_mutex;
+
+        // Wakes the sampler up on shutdown
+        std::condition_variable m_stopSampling;
+
+        // True when the sampler thread shall finish
+        bool m_samplerDone;
+
+        // Thread sampling the resident set size
+        std::thread m_sampler;
+};
+
+
+// Scoped pipeline stage: the stage is current from construction until destruction
+// Nested stages restore the enclosing stage, nothing is counted if the statistics are not enabled
+class MemoryStage
+{
+
+    public:
+
+        // Enter the named stage
+        explicit MemoryStage(const std::string&);
+
+        // Leave the stage
+        ~MemoryStage();
+
+    private:
+
+        // Index of the enclosing stage, -1 if disabled
+        int m_previous;
+};
+
+#endif // VIDEOSTAB_MEMORYSTATS_HPP
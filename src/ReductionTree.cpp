@@ -0,0 +1,109 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: ReductionTree.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <utility>
+
+// User libraries
+#include "ReductionTree.hpp"
+
+// Constructor
+ReductionTree::ReductionTree(int numBlocks) : m_numBlocks(numBlocks)
+{
+}
+
+
+// Insert the sum of a finished block
+// The node climbs the tree as long as its sibling is already finished, the pair is added without holding the lock
+// A node without sibling (odd width) is passed up unchanged
+void ReductionTree::insert(int block, FrameAccumulator& sum)
+{
+    FrameAccumulator node;
+    std::swap(node, sum);
+
+    int level = 0;
+    int index = block;
+
+    while (levelWidth(level) > 1)
+    {
+        int sibling = index ^ 1;
+
+        if (sibling < levelWidth(level))
+        {
+            FrameAccumulator other;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                std::map<std::pair<int, int>, FrameAccumulator>::iterator it = m_nodes.find(std::make_pair(level, sibling));
+                if (it == m_nodes.end())
+                {
+                    // Sibling not finished yet, it picks up this node when it is
+                    std::swap(m_nodes[std::make_pair(level, index)], node);
+                    return;
+                }
+                std::swap(other, it->second);
+                m_nodes.erase(it);
+            }
+
+            // Left plus right, the same for every run
+            if (index & 1)
+            {
+                other.merge(node);
+                std::swap(node, other);
+            }
+            else
+            {
+                node.merge(other);
+            }
+        }
+
+        level += 1;
+        index /= 2;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::swap(m_root, node);
+}
+
+
+// Sum of all blocks
+FrameAccumulator& ReductionTree::root()
+{
+    return m_root;
+}
+
+
+// Sum of the inserted blocks, the waiting nodes are added to the root
+FrameAccumulator& ReductionTree::finish()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (std::map<std::pair<int, int>, FrameAccumulator>::iterator it = m_nodes.begin(); it != m_nodes.end(); ++it)
+    {
+        if (m_root.size() == cv::Size())
+        {
+            std::swap(m_root, it->second);
+        }
+        else
+        {
+            m_root.merge(it->second);
+        }
+    }
+    m_nodes.clear();
+    return m_root;
+}
+
+
+// Number of nodes on a level of the tree
+int ReductionTree::levelWidth(int level) const
+{
+    int width = m_numBlocks;
+    for (int l = 0; l < level; ++l)
+    {
+        width = (width + 1) / 2;
+    }
+    return width;
+}
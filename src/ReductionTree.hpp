@@ -0,0 +1,61 @@
+/**************************************
+ * Header file: ReductionTree.hpp
+ *
+ * Combines partial sums of aligned
+ * frames in a fixed binary tree
+ * ordered by frame index
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_REDUCTIONTREE_HPP
+#define VIDEOSTAB_REDUCTIONTREE_HPP
+
+// C++ std libraries
+#include <map>
+#include <mutex>
+#include <utility>
+
+// User libraries
+#include "FrameAccumulator.hpp"
+
+// The frames of a window are split into blocks of consecutive frames, every block is summed up in frame order
+// Block sums are combined pairwise, (0,1) (2,3) ..., then their sums, up to the root
+// The shape of the tree only depends on the number of blocks, so the float result is bit for bit
+// the same for any number of workers and any order in which the blocks finish
+class ReductionTree
+{
+
+    public:
+
+        // Constructor for a tree over the given number of blocks
+        ReductionTree(int);
+
+        // Insert the sum of a finished block and combine it with finished siblings, thread safe
+        void insert(int, FrameAccumulator&);
+
+        // Sum of all blocks, valid once every block was inserted
+        FrameAccumulator& root();
+
+        // Sum of the inserted blocks when the remaining blocks are never inserted (early termination)
+        // The nodes waiting for a sibling are combined in (level, index) order, the same for every run
+        FrameAccumulator& finish();
+
+    private:
+
+        // Number of nodes on a level of the tree
+        int levelWidth(int) const;
+
+        // Number of blocks (leaves)
+        int m_numBlocks;
+
+        // Finished nodes waiting for their sibling, key: (level, index)
+        std::map<std::pair<int, int>, FrameAccumulator> m_nodes;
+
+        // Sum of all blocks
+        FrameAccumulator m_root;
+
+        // Protects the waiting nodes
+        std::mutex m_mutex;
+};
+
+#endif // VIDEOSTAB_REDUCTIONTREE_HPP
@@ -0,0 +1,349 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: RegressionRunner.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+// OpenCV libraries
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+// User libraries
+#include "RegressionRunner.hpp"
+#include "file_utils.h"
+
+namespace
+{
+    // Number of frames of a generated clip
+    const int kClipFrames = 24;
+
+    // Frame size of a generated clip
+    const cv::Size kClipSize(320, 240);
+
+    // Border of the texture around the frame, larger than the camera shake
+    const int kClipBorder = 16;
+}
+
+// Constructor
+// The cases cover the float and the compact pipeline, tiled rendering and a histogram blend mode
+RegressionRunner::RegressionRunner(const VideoProcessingParams& defaults, const std::string& goldenDir, const RegressionThresholds& thresholds) : m_defaults(defaults), m_goldenDir(goldenDir), m_thresholds(thresholds), m_session(defaults)
+{
+    if (!m_goldenDir.empty() && m_goldenDir[m_goldenDir.size() - 1] != '/')
+    {
+        m_goldenDir += "/";
+    }
+
+    const char* cases[][3] = {
+        { "mean", "shake", "" },
+        { "compact", "shake", "compact=1" },
+        { "tiled", "shake", "tile=64" },
+        { "median", "moving", "blend=median" },
+    };
+
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        RegressionCase regressionCase;
+        regressionCase.name = cases[i][0];
+        regressionCase.clip = cases[i][1];
+        if (cases[i][2][0] != '\0')
+        {
+            regressionCase.options.push_back(cases[i][2]);
+        }
+        m_cases.push_back(regressionCase);
+    }
+}
+
+
+// Run all cases one after the other, so the stage timings do not disturb each other
+int RegressionRunner::run(bool update)
+{
+    if (update)
+    {
+        base::FileUtils::CreateDirRecursively(m_goldenDir);
+    }
+
+    int numFailed = 0;
+    for (int i = 0; i < m_cases.size(); ++i)
+    {
+        bool passed = runCase(m_cases[i], update);
+        std::cout << (passed ? "passed " : "FAILED ") << m_cases[i].name << std::endl;
+        if (!passed)
+        {
+            ++numFailed;
+        }
+    }
+
+    std::cout << "regression done: " << m_cases.size() - numFailed << " of " << m_cases.size() << " cases passed" << std::endl;
+
+    return numFailed;
+}
+
+
+// Run a single case and compare it against its golden files
+bool RegressionRunner::runCase(const RegressionCase& regressionCase, bool update)
+{
+    std::string workDir = m_defaults.outputDir + "regression/";
+    std::string clipDir = workDir + "clips/" + regressionCase.clip + "/";
+
+    VideoProcessingParams params = m_defaults;
+    for (int i = 0; i < regressionCase.options.size(); ++i)
+    {
+        if (!parseVideoProcessingParam(regressionCase.options[i], params))
+        {
+            return false;
+        }
+    }
+    params.outputDir = workDir + regressionCase.name + "/";
+
+    if (!generateClip(clipDir, regressionCase.clip, kClipFrames, kClipSize))
+    {
+        std::cout << "cannot write clip " << clipDir << std::endl;
+        return false;
+    }
+
+    cv::Mat result;
+    std::vector<std::pair<std::string, double> > stageSeconds;
+    try
+    {
+        m_session.configure(params);
+        m_session.process(clipDir, regressionCase.clip);
+        result = cv::imread(m_session.blendedImagePath());
+        stageSeconds = m_session.stageSeconds();
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "case " << regressionCase.name << " failed: " << e.what() << std::endl;
+        return false;
+    }
+
+    if (result.empty())
+    {
+        std::cout << "case " << regressionCase.name << " wrote no blended image" << std::endl;
+        return false;
+    }
+
+    std::string goldenImagePath = m_goldenDir + regressionCase.name + ".png";
+    std::string goldenTimingsPath = m_goldenDir + regressionCase.name + ".timings";
+
+    if (update)
+    {
+        std::cout << "update " << goldenImagePath << std::endl;
+        return cv::imwrite(goldenImagePath, result) && writeTimings(goldenTimingsPath, stageSeconds);
+    }
+
+    bool passed = true;
+
+    // Correctness: the blended image against the golden image
+    cv::Mat golden = cv::imread(goldenImagePath);
+    if (golden.empty() || golden.size() != result.size())
+    {
+        std::cout << "missing or mismatching golden image " << goldenImagePath << std::endl;
+        return false;
+    }
+
+    double psnrDb = psnr(result, golden);
+    double ssimIndex = ssim(result, golden);
+    std::cout << regressionCase.name << ": PSNR " << psnrDb << " dB (min " << m_thresholds.minPsnr << "), SSIM " << ssimIndex << " (min " << m_thresholds.minSsim << ")" << std::endl;
+    if (psnrDb < m_thresholds.minPsnr || ssimIndex < m_thresholds.minSsim)
+    {
+        passed = false;
+    }
+
+    // Performance: every stage against its baseline, reported only unless the timings gate the result
+    std::vector<std::pair<std::string, double> > baseline;
+    if (!readTimings(goldenTimingsPath, baseline))
+    {
+        std::cout << "missing timing baseline " << goldenTimingsPath << std::endl;
+        return passed && !m_thresholds.gateTimings;
+    }
+
+    for (int i = 0; i < stageSeconds.size(); ++i)
+    {
+        const std::string& stage = stageSeconds[i].first;
+        double seconds = stageSeconds[i].second;
+
+        int b = 0;
+        while (b < baseline.size() && baseline[b].first != stage)
+        {
+            ++b;
+        }
+        if (b == baseline.size())
+        {
+            std::cout << regressionCase.name << ": stage " << stage << " has no baseline" << std::endl;
+            passed = passed && !m_thresholds.gateTimings;
+            continue;
+        }
+
+        double limit = baseline[b].second * (1.0 + m_thresholds.timingMargin) + m_thresholds.timingSlack;
+        bool slow = seconds > limit;
+        std::cout << regressionCase.name << ": " << stage << " " << seconds << " seconds (baseline " << baseline[b].second << ", limit " << limit << ")" << (slow ? " TOO SLOW" : "") << std::endl;
+        if (slow && m_thresholds.gateTimings)
+        {
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+
+// Write a clip of numbered PNG frames
+// A random texture of rectangles and circles is rotated and shifted by a seeded random camera shake,
+// the moving clip adds a square crossing the frame, so ghosts of the mean can be told from the median
+bool RegressionRunner::generateClip(const std::string& dir, const std::string& motion, int numFrames, const cv::Size& frameSize)
+{
+    if (!base::FileUtils::CreateDirRecursively(dir))
+    {
+        return false;
+    }
+
+    cv::RNG rng(20130601);
+
+    // Texture
+    cv::Size textureSize(frameSize.width + 2 * kClipBorder, frameSize.height + 2 * kClipBorder);
+    cv::Mat texture(textureSize, CV_8UC3, cv::Scalar(96, 128, 160));
+    for (int i = 0; i < 200; ++i)
+    {
+        cv::Point p(rng.uniform(0, textureSize.width), rng.uniform(0, textureSize.height));
+        cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+        if (i % 2 == 0)
+        {
+            cv::rectangle(texture, p, p + cv::Point(rng.uniform(4, 40), rng.uniform(4, 40)), color, -1);
+        }
+        else
+        {
+            cv::circle(texture, p, rng.uniform(3, 20), color, -1);
+        }
+    }
+    cv::GaussianBlur(texture, texture, cv::Size(0, 0), 1.0);
+
+    cv::Point2f center(0.5f * textureSize.width, 0.5f * textureSize.height);
+    for (int i = 0; i < numFrames; ++i)
+    {
+        // Camera shake: up to 3 pixels and half a degree
+        double dx = rng.uniform(-3.0, 3.0);
+        double dy = rng.uniform(-3.0, 3.0);
+        double angle = rng.uniform(-0.5, 0.5);
+
+        cv::Mat warp = cv::getRotationMatrix2D(center, angle, 1.0);
+        warp.at<double>(0, 2) += dx - kClipBorder;
+        warp.at<double>(1, 2) += dy - kClipBorder;
+
+        cv::Mat frame;
+        cv::warpAffine(texture, frame, warp, frameSize, cv::INTER_LINEAR, cv::BORDER_REFLECT);
+
+        if (motion == "moving")
+        {
+            int x = 10 + i * (frameSize.width - 50) / std::max(1, numFrames - 1);
+            cv::rectangle(frame, cv::Point(x, frameSize.height / 2 - 15), cv::Point(x + 30, frameSize.height / 2 + 15), cv::Scalar(0, 0, 255), -1);
+        }
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%03d.png", i);
+        if (!cv::imwrite(dir + name, frame))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Peak signal to noise ratio of two 8-bit images
+double RegressionRunner::psnr(const cv::Mat& a, const cv::Mat& b)
+{
+    double sqError = cv::norm(a, b, cv::NORM_L2SQR);
+    if (sqError == 0.0)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    double mse = sqError / ((double) a.total() * a.channels());
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+
+// Mean structural similarity of the luminance (Wang et al. 2004)
+double RegressionRunner::ssim(const cv::Mat& a, const cv::Mat& b)
+{
+    const double C1 = (0.01 * 255) * (0.01 * 255);
+    const double C2 = (0.03 * 255) * (0.03 * 255);
+    const cv::Size window(11, 11);
+    const double sigma = 1.5;
+
+    cv::Mat x, y;
+    cv::cvtColor(a, x, cv::COLOR_BGR2GRAY);
+    cv::cvtColor(b, y, cv::COLOR_BGR2GRAY);
+    x.convertTo(x, CV_32F);
+    y.convertTo(y, CV_32F);
+
+    cv::Mat muX, muY;
+    cv::GaussianBlur(x, muX, window, sigma);
+    cv::GaussianBlur(y, muY, window, sigma);
+
+    cv::Mat muXSq = muX.mul(muX);
+    cv::Mat muYSq = muY.mul(muY);
+    cv::Mat muXY = muX.mul(muY);
+
+    cv::Mat sigmaXSq, sigmaYSq, sigmaXY;
+    cv::GaussianBlur(x.mul(x), sigmaXSq, window, sigma);
+    cv::GaussianBlur(y.mul(y), sigmaYSq, window, sigma);
+    cv::GaussianBlur(x.mul(y), sigmaXY, window, sigma);
+    sigmaXSq -= muXSq;
+    sigmaYSq -= muYSq;
+    sigmaXY -= muXY;
+
+    cv::Mat numerator = (2 * muXY + C1).mul(2 * sigmaXY + C2);
+    cv::Mat denominator = (muXSq + muYSq + C1).mul(sigmaXSq + sigmaYSq + C2);
+    cv::Mat ssimMap;
+    cv::divide(numerator, denominator, ssimMap);
+
+    return cv::mean(ssimMap)[0];
+}
+
+
+// Read stage timings
+bool RegressionRunner::readTimings(const std::string& path, std::vector<std::pair<std::string, double> >& timings)
+{
+    std::ifstream file(path.c_str());
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    timings.clear();
+    std::string stage;
+    double seconds;
+    while (file >> stage >> seconds)
+    {
+        timings.push_back(std::make_pair(stage, seconds));
+    }
+    return true;
+}
+
+
+// Write stage timings
+bool RegressionRunner::writeTimings(const std::string& path, const std::vector<std::pair<std::string, double> >& timings)
+{
+    std::ofstream file(path.c_str());
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    for (int i = 0; i < timings.size(); ++i)
+    {
+        file << timings[i].first << " " << timings[i].second << std::endl;
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+/**************************************
+ * Header file: RegressionRunner.hpp
+ *
+ * End-to-end regression of the whole
+ * pipeline on generated clips against
+ * golden images and stage timings
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_REGRESSIONRUNNER_HPP
+#define VIDEOSTAB_REGRESSIONRUNNER_HPP
+
+// C++ std libraries
+#include <string>
+#include <utility>
+#include <vector>
+
+// OpenCV libraries
+#include <opencv2/core/core.hpp>
+
+// User libraries
+#include "VideoProcessing.hpp"
+#include "VideoProcessingParams.hpp"
+
+// A single run of the pipeline
+struct RegressionCase {
+    std::string name; // name of the case, its golden files are <name>.png and <name>.timings
+    std::string clip; // generated clip: shake (camera shake) or moving (camera shake and a moving object)
+    std::vector<std::string> options; // key=value options on top of the default settings
+};
+
+// Thresholds a run has to meet
+struct RegressionThresholds {
+    RegressionThresholds() : minPsnr(40.0), minSsim(0.98), gateTimings(false), timingMargin(0.25), timingSlack(0.05) {}
+
+    double minPsnr; // min PSNR (dB) of the blended image against the golden image
+    double minSsim; // min SSIM of the luminance of the blended image against the golden image
+    bool gateTimings; // fail a case on a slow stage, otherwise timings are only reported (baselines are only valid on the machine that wrote them)
+    double timingMargin; // max relative slowdown of a stage against the baseline
+    double timingSlack; // absolute seconds a stage may exceed the baseline in any case, hides timer noise of short stages
+};
+
+class RegressionRunner
+{
+
+    public:
+
+        // Constructor takes the default settings of all cases, the directory of the golden files and the thresholds
+        RegressionRunner(const VideoProcessingParams&, const std::string&, const RegressionThresholds& = RegressionThresholds());
+
+        // Run all cases, with update the outputs become the new golden files, return number of failed cases
+        int run(bool);
+
+        // Write a clip of numbered PNG frames of the given motion and size, the same for every run
+        static bool generateClip(const std::string&, const std::string&, int, const cv::Size&);
+
+        // Peak signal to noise ratio of two 8-bit images in dB, infinite for equal images
+        static double psnr(const cv::Mat&, const cv::Mat&);
+
+        // Mean structural similarity of the luminance of two 8-bit images (11x11 Gaussian window, sigma 1.5)
+        static double ssim(const cv::Mat&, const cv::Mat&);
+
+    private:
+
+        // Run a single case, return true if it passed
+        bool runCase(const RegressionCase&, bool);
+
+        // Read stage timings, one "<stage> <seconds>" per line
+        static bool readTimings(const std::string&, std::vector<std::pair<std::string, double> >&);
+
+        // Write stage timings
+        static bool writeTimings(const std::string&, const std::vector<std::pair<std::string, double> >&);
+
+        // Default settings
+        VideoProcessingParams m_defaults;
+
+        // Directory of the golden images and timing baselines
+        std::string m_goldenDir;
+
+        // Pass criteria
+        RegressionThresholds m_thresholds;
+
+        // All cases
+        std::vector<RegressionCase> m_cases;
+
+        // Session running all cases in turn
+        VideoProcessing m_session;
+};
+
+#endif // VIDEOSTAB_REGRESSIONRUNNER_HPP
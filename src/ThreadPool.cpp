@@ -0,0 +1,322 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: ThreadPool.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <algorithm>
+#include <iostream>
+
+// User libraries
+#include "ThreadPool.hpp"
+
+namespace
+{
+    // Pool and worker index of the calling thread, null and -1 outside of a pool
+    thread_local const ThreadPool* tlsPool = 0;
+    thread_local int tlsWorker = -1;
+}
+
+// Constructor: start the worker threads
+ThreadPool::ThreadPool(int numThreads) : m_queuedTasks(0), m_nextWorker(0), m_stop(false), m_start(std::chrono::steady_clock::now())
+{
+    if (numThreads <= 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // All deques exist before the first worker may steal
+    for (int i = 0; i < numThreads; ++i)
+    {
+        m_workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for (int i = 0; i < numThreads; ++i)
+    {
+        m_threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+
+// Destructor: finish remaining tasks and join the workers
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_taskAvailable.notify_all();
+
+    for (int i = 0; i < m_threads.size(); ++i)
+    {
+        m_threads[i].join();
+    }
+}
+
+
+// Submit a task of the group to the pool
+void ThreadPool::submit(TaskGroup& group, const std::function<void()>& task)
+{
+    if (tlsPool == this)
+    {
+        submit(group, task, tlsWorker);
+    }
+    else
+    {
+        submit(group, task, m_nextWorker++ % m_workers.size());
+    }
+}
+
+
+// Submit a task of the group to the worker given by the hint
+void ThreadPool::submit(TaskGroup& group, const std::function<void()>& task, int hint)
+{
+    Task t;
+    t.run = task;
+    t.group = &group;
+    push((unsigned) hint % m_workers.size(), t);
+}
+
+
+// Block until all tasks of the group are done
+// Queued tasks of the group are run by the waiting thread, otherwise it sleeps until a task of the group finishes or is queued
+void ThreadPool::wait(TaskGroup& group)
+{
+    Worker* worker = (tlsPool == this) ? m_workers[tlsWorker].get() : 0;
+    while (true)
+    {
+        Task task;
+        if (takeFromGroup(group, task))
+        {
+            run(task, worker);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(group.m_mutex);
+        if (group.m_pending == 0)
+        {
+            break;
+        }
+        if (group.m_queued == 0)
+        {
+            group.m_changed.wait(lock);
+        }
+    }
+
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(group.m_mutex);
+        std::swap(error, group.m_error);
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+
+// Return number of worker threads
+int ThreadPool::numThreads() const
+{
+    return m_workers.size();
+}
+
+
+// Return the utilization counters since the pool started or the last reset
+ThreadPoolStats ThreadPool::stats() const
+{
+    ThreadPoolStats s;
+    s.tasksExecuted = 0;
+    s.tasksStolen = 0;
+    long long busyNanoseconds = 0;
+    for (int i = 0; i < m_workers.size(); ++i)
+    {
+        s.tasksExecuted += m_workers[i]->tasksExecuted;
+        s.tasksStolen += m_workers[i]->tasksStolen;
+        busyNanoseconds += m_workers[i]->busyNanoseconds;
+    }
+    s.busySeconds = busyNanoseconds * 1e-9;
+    s.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    s.utilization = s.wallSeconds > 0.0 ? s.busySeconds / (s.wallSeconds * m_workers.size()) : 0.0;
+    return s;
+}
+
+
+// Restart the utilization counters
+// Tasks running during the reset are counted in the new period
+void ThreadPool::resetStats()
+{
+    for (int i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i]->tasksExecuted = 0;
+        m_workers[i]->tasksStolen = 0;
+        m_workers[i]->busyNanoseconds = 0;
+    }
+    m_start = std::chrono::steady_clock::now();
+}
+
+
+// Print the utilization counters
+void ThreadPool::printStats(const std::string& label) const
+{
+    ThreadPoolStats s = stats();
+    std::cout << "thread pool (" << label << "): " << m_workers.size() << " workers, " << s.tasksExecuted << " tasks (" << s.tasksStolen << " stolen), "
+              << "busy " << s.busySeconds << " of " << s.wallSeconds << " seconds, utilization " << 100.0 * s.utilization << "%" << std::endl;
+}
+
+
+// Worker thread main loop: run own tasks, then steal, sleep when there is nothing to do
+// The pool stops once it is shut down and all deques are drained
+void ThreadPool::workerLoop(int index)
+{
+    tlsPool = this;
+    tlsWorker = index;
+
+    while (true)
+    {
+        Task task;
+        if (popLocal(index, task) || steal(index, task))
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            run(task, m_workers[index].get());
+            m_workers[index]->busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stop && m_queuedTasks == 0)
+        {
+            m_taskAvailable.wait(lock);
+        }
+        if (m_stop && m_queuedTasks == 0)
+        {
+            return;
+        }
+    }
+}
+
+
+// Push a task to the deque of a worker
+// The counters of the group are raised first, so wait() never sees a queued task as done
+void ThreadPool::push(int index, const Task& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(task.group->m_mutex);
+        ++task.group->m_pending;
+        ++task.group->m_queued;
+    }
+    task.group->m_changed.notify_all();
+
+    {
+        std::lock_guard<std::mutex> lock(m_workers[index]->mutex);
+        m_workers[index]->tasks.push_back(task);
+    }
+    ++m_queuedTasks;
+
+    // A worker going to sleep checks the queued tasks under this lock, so the notification cannot get lost
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_taskAvailable.notify_one();
+}
+
+
+// Take the newest task of the own deque
+bool ThreadPool::popLocal(int index, Task& task)
+{
+    Worker& worker = *m_workers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty())
+    {
+        return false;
+    }
+    task = worker.tasks.back();
+    worker.tasks.pop_back();
+    --m_queuedTasks;
+    dequeued(task);
+    return true;
+}
+
+
+// Take the oldest task of another worker
+bool ThreadPool::steal(int index, Task& task)
+{
+    for (int k = 1; k < m_workers.size(); ++k)
+    {
+        Worker& victim = *m_workers[(index + k) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            --m_queuedTasks;
+            ++m_workers[index]->tasksStolen;
+            dequeued(task);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Take the oldest queued task of the group, the deques are searched front to back
+bool ThreadPool::takeFromGroup(const TaskGroup& group, Task& task)
+{
+    for (int k = 0; k < m_workers.size(); ++k)
+    {
+        Worker& worker = *m_workers[k];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        for (std::deque<Task>::iterator it = worker.tasks.begin(); it != worker.tasks.end(); ++it)
+        {
+            if (it->group == &group)
+            {
+                task = *it;
+                worker.tasks.erase(it);
+                --m_queuedTasks;
+                dequeued(task);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+// Count a task taken from a deque as no longer queued in its group
+void ThreadPool::dequeued(const Task& task)
+{
+    std::lock_guard<std::mutex> lock(task.group->m_mutex);
+    --task.group->m_queued;
+}
+
+
+// Run a task, an exception is kept in the group instead of terminating the worker
+// Tasks run by a waiting worker are counted for it, their time is part of the task that waits
+// The group may be destroyed as soon as its pending count drops to zero, so it is not touched afterwards
+void ThreadPool::run(Task& task, Worker* worker)
+{
+    std::exception_ptr error;
+    try
+    {
+        task.run();
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    if (worker)
+    {
+        ++worker->tasksExecuted;
+    }
+
+    TaskGroup& group = *task.group;
+    std::lock_guard<std::mutex> lock(group.m_mutex);
+    if (error && !group.m_error)
+    {
+        group.m_error = error;
+    }
+    --group.m_pending;
+    group.m_changed.notify_all();
+}
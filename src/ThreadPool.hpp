@@ -0,0 +1,172 @@
+/**************************************
+ * Header file: ThreadPool.hpp
+ *
+ * Fixed size pool of worker threads
+ * shared by all jobs of a process
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_THREADPOOL_HPP
+#define VIDEOSTAB_THREADPOOL_HPP
+
+// C++ std libraries
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Utilization counters of a pool
+struct ThreadPoolStats {
+    long tasksExecuted; // tasks run by all workers
+    long tasksStolen; // tasks a worker took from the deque of another worker
+    double busySeconds; // time all workers spent running tasks
+    double wallSeconds; // lifetime of the pool
+    double utilization; // busySeconds / (wallSeconds * number of workers)
+};
+
+// Tasks of one stage that are waited for together
+// Every stage waits for its own group only, so clips, stages and decoders can share one pool
+// The first exception thrown by a task of the group is rethrown by ThreadPool::wait
+class TaskGroup
+{
+
+    public:
+
+        // Constructor of an empty group
+        TaskGroup() : m_pending(0), m_queued(0) {}
+
+    private:
+
+        friend class ThreadPool;
+
+        // Protects the counters and the exception
+        std::mutex m_mutex;
+
+        // Signals finished and newly queued tasks to the waiting thread
+        std::condition_variable m_changed;
+
+        // Number of submitted but not yet finished tasks
+        int m_pending;
+
+        // Number of tasks still in a deque
+        int m_queued;
+
+        // First exception thrown by a task, null if none
+        std::exception_ptr m_error;
+};
+
+// Work stealing pool: every worker owns a deque of tasks
+// A worker runs the newest task of its own deque first (its data is still in cache)
+// and steals the oldest task of another worker when its deque is empty
+class ThreadPool
+{
+
+    public:
+
+        // Constructor starts the worker threads, 0: one worker per hardware thread
+        ThreadPool(int = 0);
+
+        // Destructor finishes all submitted tasks and joins the workers
+        ~ThreadPool();
+
+        // Submit a task of the group to the pool
+        // Tasks submitted by a worker go to its own deque, others are spread round robin
+        void submit(TaskGroup&, const std::function<void()>&);
+
+        // Submit a task of the group to the deque of the worker given by the hint (modulo number of workers)
+        // Tasks working on the same data (e.g. the same tile in every frame) should pass the same hint
+        void submit(TaskGroup&, const std::function<void()>&, int);
+
+        // Block until all tasks of the group are done, rethrow the first exception of its tasks
+        // The waiting thread runs queued tasks of the group itself, so workers may wait for nested groups
+        void wait(TaskGroup&);
+
+        // Return number of worker threads
+        int numThreads() const;
+
+        // Return the utilization counters since the pool started or the last reset
+        ThreadPoolStats stats() const;
+
+        // Restart the utilization counters
+        void resetStats();
+
+        // Print the utilization counters, the label names the work they cover
+        void printStats(const std::string&) const;
+
+    private:
+
+        // Submitted task and the group it belongs to
+        struct Task
+        {
+            Task() : group(0) {}
+
+            std::function<void()> run;
+            TaskGroup* group;
+        };
+
+        // Task deque and counters of a worker
+        struct Worker
+        {
+            Worker() : tasksExecuted(0), tasksStolen(0), busyNanoseconds(0) {}
+
+            std::deque<Task> tasks;
+            std::mutex mutex;
+            std::atomic<long> tasksExecuted;
+            std::atomic<long> tasksStolen;
+            std::atomic<long long> busyNanoseconds;
+        };
+
+        // Worker thread main loop
+        void workerLoop(int);
+
+        // Push a task to the deque of a worker and wake up a sleeping worker
+        void push(int, const Task&);
+
+        // Take the newest task of the own deque
+        bool popLocal(int, Task&);
+
+        // Take the oldest task of another worker, the victims are visited starting at the right neighbour
+        bool steal(int, Task&);
+
+        // Take the oldest queued task of the group from any deque
+        bool takeFromGroup(const TaskGroup&, Task&);
+
+        // Count a task taken from a deque as no longer queued in its group
+        void dequeued(const Task&);
+
+        // Run a task, record its exception in the group and count it as finished, the worker is null outside of the pool
+        void run(Task&, Worker*);
+
+        // Worker threads
+        std::vector<std::thread> m_threads;
+
+        // Deques and counters, one per worker thread
+        std::vector<std::unique_ptr<Worker> > m_workers;
+
+        // Protects sleeping and waking up, and the stop flag
+        std::mutex m_mutex;
+
+        // Signals new tasks or shutdown to the workers
+        std::condition_variable m_taskAvailable;
+
+        // Number of tasks in all deques
+        std::atomic<int> m_queuedTasks;
+
+        // Next worker of the round robin submission
+        std::atomic<unsigned> m_nextWorker;
+
+        // Set when the pool shuts down
+        bool m_stop;
+
+        // Start of the pool or of the last reset of the counters
+        std::chrono::steady_clock::time_point m_start;
+};
+
+#endif // VIDEOSTAB_THREADPOOL_HPP
@@ -0,0 +1,88 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: TileWriter.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+// User libraries
+#include "TileWriter.hpp"
+
+// Constructor: write the PPM header and reserve space for the whole image
+TileWriter::TileWriter(const std::string& filePath, cv::Size imageSize) : m_imageSize(imageSize), m_dataOffset(0)
+{
+    m_file.open(filePath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_file.is_open())
+    {
+        std::cout << "Cannot create output file " << filePath << std::endl;
+        return;
+    }
+
+    std::ostringstream header;
+    header << "P6\n" << imageSize.width << " " << imageSize.height << "\n255\n";
+    m_file << header.str();
+    m_dataOffset = header.str().size();
+
+    // Grow the file to its final size, tiles get written in arbitrary order
+    std::streamoff dataSize = (std::streamoff) imageSize.width * imageSize.height * 3;
+    if (dataSize > 0)
+    {
+        m_file.seekp(m_dataOffset + dataSize - 1);
+        m_file.put(0);
+    }
+
+    std::cout << "writing tiles to " << filePath << std::endl;
+}
+
+
+// Write tile rows at their final position in the file
+// PPM stores RGB, OpenCV frames are BGR
+bool TileWriter::writeTile(const cv::Mat& tile, cv::Point topLeft)
+{
+    if (!m_file.is_open() || tile.type() != CV_8UC3)
+    {
+        return false;
+    }
+
+    std::vector<char> rowBuffer(tile.cols * 3);
+
+    for (int i = 0; i < tile.rows; ++i)
+    {
+        const cv::Vec3b* srcRow = tile.ptr<cv::Vec3b>(i);
+        for (int j = 0; j < tile.cols; ++j)
+        {
+            rowBuffer[3 * j + 0] = srcRow[j][2];
+            rowBuffer[3 * j + 1] = srcRow[j][1];
+            rowBuffer[3 * j + 2] = srcRow[j][0];
+        }
+
+        std::streamoff rowOffset = ((std::streamoff) (topLeft.y + i) * m_imageSize.width + topLeft.x) * 3;
+        m_file.seekp(m_dataOffset + rowOffset);
+        m_file.write(&rowBuffer[0], rowBuffer.size());
+    }
+
+    return m_file.good();
+}
+
+
+// Flush and close the output file
+void TileWriter::close()
+{
+    if (m_file.is_open())
+    {
+        m_file.close();
+    }
+}
+
+
+// Return true if the output file could be created
+bool TileWriter::isOpen() const
+{
+    return m_file.is_open();
+}
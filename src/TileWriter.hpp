@@ -0,0 +1,48 @@
+/**************************************
+ * Header file: TileWriter.hpp
+ *
+ * Writes finished render tiles straight
+ * into a binary PPM image on disk
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_TILEWRITER_HPP
+#define VIDEOSTAB_TILEWRITER_HPP
+
+// C++ std libraries
+#include <fstream>
+#include <string>
+
+// OpenCV libraries
+#include <opencv2/core/core.hpp>
+
+class TileWriter
+{
+
+    public:
+
+        // Constructor creates the output file for an image of the given size
+        TileWriter(const std::string&, cv::Size);
+
+        // Write a CV_8UC3 tile with its top left corner at the given position
+        bool writeTile(const cv::Mat&, cv::Point);
+
+        // Flush and close the output file
+        void close();
+
+        // Return true if the output file could be created
+        bool isOpen() const;
+
+    private:
+
+        // Output file stream
+        std::ofstream m_file;
+
+        // Size of the whole image
+        cv::Size m_imageSize;
+
+        // Byte offset of the first pixel (size of the PPM header)
+        std::streamoff m_dataOffset;
+};
+
+#endif // VIDEOSTAB_TILEWRITER_HPP
@@ -0,0 +1,143 @@
+/* ****************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: VideoExporter.cpp
+ * ****************************/
+
+// C++ std libraries
+#include <algorithm>
+#include <iostream>
+
+// User libraries
+#include "VideoExporter.hpp"
+
+// Constructor: open the video file and start the encoder thread
+VideoExporter::VideoExporter(const std::string& filePath, const std::string& fourcc, double fps, const cv::Size& frameSize, int queueLength) : m_filePath(filePath), m_queueLength(std::max(1, queueLength)), m_nextPosition(0), m_writerStalls(0), m_closing(false)
+{
+    int code = fourcc.size() == 4 ? cv::VideoWriter::fourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]) : cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+    if (!m_writer.open(filePath, code, fps, frameSize, true))
+    {
+        std::cout << "Cannot open video writer " << filePath << std::endl;
+        return;
+    }
+
+    m_encoder = std::thread(&VideoExporter::encodeLoop, this);
+}
+
+
+// Destructor
+VideoExporter::~VideoExporter()
+{
+    close();
+}
+
+
+// Return true if the video file could be opened
+bool VideoExporter::isOpen() const
+{
+    return m_encoder.joinable();
+}
+
+
+// Hand over a frame, blocks while its position is too far ahead of the encoder
+void VideoExporter::write(int position, const cv::Mat& frame)
+{
+    if (!isOpen())
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (position >= m_nextPosition + m_queueLength)
+    {
+        ++m_writerStalls;
+        while (position >= m_nextPosition + m_queueLength && !m_closing)
+        {
+            m_frameEncoded.wait(lock);
+        }
+    }
+    if (position < m_nextPosition || m_closing)
+    {
+        return;
+    }
+
+    m_queue[position] = frame;
+    if (position == m_nextPosition)
+    {
+        m_frameAvailable.notify_one();
+    }
+}
+
+
+// Encode the frames up to the first missing position and close the file
+void VideoExporter::close()
+{
+    if (!isOpen())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+    }
+    m_frameAvailable.notify_one();
+    m_frameEncoded.notify_all();
+    m_encoder.join();
+
+    m_writer.release();
+    if (!m_queue.empty())
+    {
+        std::cout << m_queue.size() << " frames after the missing frame " << m_nextPosition << " were not encoded" << std::endl;
+        m_queue.clear();
+    }
+    std::cout << m_filePath << ": " << m_nextPosition << " frames encoded, " << m_writerStalls << " writer stalls" << std::endl;
+}
+
+
+// Return number of encoded frames
+int VideoExporter::framesWritten() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nextPosition;
+}
+
+
+// Return number of waits of callers on the queue
+int VideoExporter::writerStalls() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_writerStalls;
+}
+
+
+// Encoder thread main loop: encode the next frame as soon as it arrived, the lock is released while encoding
+void VideoExporter::encodeLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        std::map<int, cv::Mat>::iterator next = m_queue.find(m_nextPosition);
+        if (next == m_queue.end())
+        {
+            if (m_closing)
+            {
+                return;
+            }
+            m_frameAvailable.wait(lock);
+            continue;
+        }
+
+        cv::Mat frame = next->second;
+        m_queue.erase(next);
+
+        lock.unlock();
+        m_writer.write(frame);
+        lock.lock();
+
+        ++m_nextPosition;
+        m_frameEncoded.notify_all();
+    }
+}
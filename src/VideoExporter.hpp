@@ -0,0 +1,96 @@
+/**************************************
+ * Header file: VideoExporter.hpp
+ *
+ * Writes the stabilized clip with
+ * cv::VideoWriter on an encoder thread
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_VIDEOEXPORTER_HPP
+#define VIDEOSTAB_VIDEOEXPORTER_HPP
+
+// C++ std libraries
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// OpenCV libraries
+#include <opencv2/core/core.hpp>
+#include <opencv2/videoio.hpp>
+
+// Encoder of the stabilized clip
+// Frames are handed over with their position in the clip by any number of threads, in any order,
+// and encoded in clip order. A frame waits in the queue until all frames before it arrived,
+// a frame more than the queue length ahead of the next frame to encode blocks the caller (back-pressure)
+class VideoExporter
+{
+
+    public:
+
+        // Constructor opens the video file (path, four character code, frames per second, frame size, queue length)
+        VideoExporter(const std::string&, const std::string&, double, const cv::Size&, int);
+
+        // Destructor encodes the remaining frames and closes the file
+        ~VideoExporter();
+
+        // Return true if the video file could be opened
+        bool isOpen() const;
+
+        // Hand over the 8-bit BGR frame at the given position of the clip
+        void write(int, const cv::Mat&);
+
+        // Encode the frames up to the first missing position and close the file
+        void close();
+
+        // Return number of encoded frames
+        int framesWritten() const;
+
+        // Return number of times a caller waited for the queue (back-pressure)
+        int writerStalls() const;
+
+    private:
+
+        // Not copyable, the encoder thread refers to the object
+        VideoExporter(const VideoExporter&);
+        VideoExporter& operator=(const VideoExporter&);
+
+        // Encoder thread main loop
+        void encodeLoop();
+
+        // Video file path
+        std::string m_filePath;
+
+        // Video writer, only touched by the encoder thread while it runs
+        cv::VideoWriter m_writer;
+
+        // Frames waiting for encoding by clip position
+        std::map<int, cv::Mat> m_queue;
+
+        // Max distance of a queued position from the next position to encode
+        int m_queueLength;
+
+        // Position of the next frame to encode
+        int m_nextPosition;
+
+        // Number of waits of callers on the queue
+        int m_writerStalls;
+
+        // Set when no more frames are handed over
+        bool m_closing;
+
+        // Protects the queue and the counters
+        mutable std::mutex m_mutex;
+
+        // Signals a new frame or closing to the encoder thread
+        std::condition_variable m_frameAvailable;
+
+        // Signals an encoded frame to waiting callers
+        std::condition_variable m_frameEncoded;
+
+        // Encoder thread
+        std::thread m_encoder;
+};
+
+#endif // VIDEOSTAB_VIDEOEXPORTER_HPP
@@ -10,30 +10,47 @@
 // OpenCV libraries
 #include <opencv2/video/video.hpp>
 #include <opencv2/features2d/features2d.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 // User libraries
 #include "VideoFrame.hpp"
+#include "FrameAccumulator.hpp"
+#include "BilinearSampler.hpp"
+#include "WeightKernels.hpp"
 #include "Drawing.hpp"
 
 // Constructor: (called in VideoData)
-VideoFrame::VideoFrame(cv::Mat& frame)
+VideoFrame::VideoFrame(cv::Mat& frame) : m_compact(false), m_frameSize(frame.size()), m_origin(0, 0), m_weightKernel("powexp"), m_powerExpKernel(0)
 {
 
-    // m_frameData stores all frame data in CV_8UC3 format
-    frame.copyTo(m_frameData);
+    init(frame, false);
 
-    // Temporary container to convert frame type from CV_8UC3 to CV_32FC3
-    cv::Mat tmpFrame32f(frame.size(), CV_32FC3);
-    
-    // Convert frame data to CV_32FC3
-    frame.convertTo(tmpFrame32f, CV_32FC3);
+    // m_alignedFrameData stores transformed frame of different type format
+    m_alignedFrameData32f = cv::Mat::zeros(frame.size(), CV_32FC3);
 
-    // m_frameData32f stores all frame data in CV_32FC3 format
-    tmpFrame32f.copyTo(m_frameData32f);
+}
 
-    // m_alignedFrameData stores transformed frame of different type format
-    //tmpFrame32f.copyTo(m_alignedFrameData32f);
-    m_alignedFrameData32f = cv::Mat::zeros(tmpFrame32f.size(), tmpFrame32f.type());
+
+// Constructor: keep only the region of the frame a render tile samples from
+// The aligned frame data is allocated by the tile alignment
+VideoFrame::VideoFrame(cv::Mat& frame, const cv::Rect& region, bool compact) : m_compact(compact), m_frameSize(frame.size()), m_origin(region.tl()), m_weightKernel("powexp"), m_powerExpKernel(0)
+{
+
+    init(frame(region), compact);
+
+}
+
+
+// Initialize frame data containers
+void VideoFrame::init(const cv::Mat& frame, bool compact)
+{
+
+    // m_frameData stores all frame data in CV_8UC3 (or CV_16UC3) format
+    // The samplers read it directly, there is no floating point copy
+    // It is a view into a copy with a zero border, samples near or beyond the edge read the border without bounds checks
+    cv::Mat padded;
+    cv::copyMakeBorder(frame, padded, kSamplerBorderBefore, kSamplerBorderAfter, kSamplerBorderBefore, kSamplerBorderAfter, cv::BORDER_CONSTANT | cv::BORDER_ISOLATED, cv::Scalar::all(0));
+    m_frameData = padded(cv::Rect(kSamplerBorderBefore, kSamplerBorderBefore, frame.cols, frame.rows));
 
     // m_keypoints stores all keypoints 
     m_keypoints = std::vector<cv::Point2f>();
@@ -53,8 +70,8 @@ void VideoFrame::calcOpticalFlow(VideoFrame& nextFrame)
 
     // Convert both frames to grayscale images
     cv::Mat prevImg, nextImg;
-    cv::cvtColor(m_frameData, prevImg, cv::COLOR_RGB2GRAY);
-    cv::cvtColor(nextFrame.m_frameData, nextImg, cv::COLOR_RGB2GRAY);
+    getGreyFrameData(prevImg);
+    nextFrame.getGreyFrameData(nextImg);
 
     // Calculate optical flow using interative Lucas-Kanade method
     cv::calcOpticalFlowPyrLK(prevImg, nextImg, m_keypoints, nextFrame.m_keypoints, nextFrame.m_status, m_error);
@@ -170,31 +187,122 @@ void VideoFrame::findBestFeatures(std::vector<int>& bestFeatures)
 }
 
 
+// Combine the trajectories of this (forward tracked) frame with the ones of a frame tracked backward from the same reference frame
+// A feature is a match only if it was matched on both sides, errors and lengths add up
+// and the motion vector spans the whole window (first to last frame)
+void VideoFrame::combineFeatureData(const VideoFrame& backward)
+{
+    for (int i = 0; i < m_featureData.size() && i < backward.m_featureData.size(); ++i)
+    {
+        const FFeature& back = backward.m_featureData[i];
+        m_featureData[i].stat = m_featureData[i].stat && back.stat;
+        m_featureData[i].err += back.err;
+        m_featureData[i].len += back.len;
+        m_featureData[i].mvec -= back.mvec;
+    }
+}
+
+
 // Align two (consecutive) frames to stabilize video
 // Using the feature based mapping method
-void VideoFrame::alignFrameByFeatureBasedMorphing(const std::vector<cv::Point2f>& refFrameKeypts, std::vector<cv::Point2f>& keypoints, std::vector<int>& bestFeatures)
+void VideoFrame::alignFrameByFeatureBasedMorphing(const std::vector<cv::Point2f>& refFrameKeypts, std::vector<cv::Point2f>& keypoints, std::vector<int>& bestFeatures, cv::Mat* displacement)
+{
+    alignTileByFeatureBasedMorphing(refFrameKeypts, keypoints, bestFeatures, cv::Rect(cv::Point(0, 0), m_frameSize), displacement);
+}
+
+
+// Align a tile of the frame, the tile is given in frame coordinates
+// The frame data has to cover the tile plus the maximum displacement
+void VideoFrame::alignTileByFeatureBasedMorphing(const std::vector<cv::Point2f>& refFrameKeypts, std::vector<cv::Point2f>& keypoints, std::vector<int>& bestFeatures, const cv::Rect& tile, cv::Mat* displacement)
+{
+    morphTile(refFrameKeypts, keypoints, bestFeatures, tile, 0, displacement);
+}
+
+
+// Morph a tile and add every interpolated sample to the accumulator
+// Only one aligned row is held at a time, it stays in cache until it is added
+void VideoFrame::accumulateTileByFeatureBasedMorphing(const std::vector<cv::Point2f>& refFrameKeypts, std::vector<cv::Point2f>& keypoints, std::vector<int>& bestFeatures, const cv::Rect& tile, FrameAccumulator& accumulator)
 {
+    morphTile(refFrameKeypts, keypoints, bestFeatures, tile, &accumulator, 0);
+}
 
-    // Create look up for interpolated weighting function for N sample points
-    int N = 500;
-    std::vector<float> intpWeights = std::vector<float>(N, 0.0);
 
-    // Maximum distance of two pixels
-    float maxDist = std::sqrt(m_frameData32f.size().width * m_frameData32f.size().width + m_frameData32f.size().height * m_frameData32f.size().height);
+// Feature based morphing of a tile
+// @accumulator:  if given, aligned rows are added to it instead of being stored in the aligned frame data
+// @displacement: if given, receives the magnitude of the lookup vectors
+// The weight kernel is chosen once per tile, the morph itself is instantiated per kernel
+// Without a shared table the powexp kernel is tabulated here
+void VideoFrame::morphTile(const std::vector<cv::Point2f>& refFrameKeypts, std::vector<cv::Point2f>& keypoints, std::vector<int>& bestFeatures, const cv::Rect& tile, FrameAccumulator* accumulator, cv::Mat* displacement)
+{
+    if (m_weightKernel == "gaussian")
+    {
+        morphTileWithKernel(GaussianKernel(m_frameSize), refFrameKeypts, keypoints, bestFeatures, tile, accumulator, displacement);
+    }
+    else if (m_weightKernel == "idw")
+    {
+        morphTileWithKernel(InverseDistanceKernel(m_frameSize), refFrameKeypts, keypoints, bestFeatures, tile, accumulator, displacement);
+    }
+    else if (m_weightKernel == "wendland")
+    {
+        morphTileWithKernel(WendlandKernel(m_frameSize), refFrameKeypts, keypoints, bestFeatures, tile, accumulator, displacement);
+    }
+    else if (m_powerExpKernel && m_powerExpKernel->frameSize() == m_frameSize)
+    {
+        morphTileWithKernel(*m_powerExpKernel, refFrameKeypts, keypoints, bestFeatures, tile, accumulator, displacement);
+    }
+    else
+    {
+        morphTileWithKernel(PowerExpKernel(m_frameSize), refFrameKeypts, keypoints, bestFeatures, tile, accumulator, displacement);
+    }
+}
 
-    // Step width of sample points
-    float step = maxDist / N;
 
-    // Interpolated function ranges from [0..maxDist]
-    for (int sIdx = 0; sIdx < N; ++sIdx)
+// Feature based morphing of a tile with the weight kernel policy Kernel
+// @kernel: weight of a feature at a distance, see WeightKernels.hpp
+template<typename Kernel>
+void VideoFrame::morphTileWithKernel(const Kernel& kernel, const std::vector<cv::Point2f>& refFrameKeypts, std::vector<cv::Point2f>& keypoints, std::vector<int>& bestFeatures, const cv::Rect& tile, FrameAccumulator* accumulator, cv::Mat* displacement)
+{
+
+    // Aligned tile data, a single row if the samples go to an accumulator
+    cv::Size alignedSize = accumulator ? cv::Size(tile.width, 1) : tile.size();
+    cv::Mat aligned;
+    if (m_compact)
+    {
+        m_alignedFrameData16u.create(alignedSize, CV_16UC3);
+        aligned = m_alignedFrameData16u;
+    }
+    else
     {
-        intpWeights[sIdx] = weightFunction(sIdx * step);
+        m_alignedFrameData32f.create(alignedSize, CV_32FC3);
+        aligned = m_alignedFrameData32f;
     }
 
-    // Iterate over all pixels in the frame (m_frameData)
-    for (int i = 0; i < m_frameData32f.size().height; ++i)
+    // Coverage of the aligned samples by the frame
+    m_validity.create(alignedSize, CV_32FC1);
+
+    // Magnitude of the lookup vectors, only if requested
+    cv::Mat dispRows;
+    if (displacement)
     {
-        for (int j = 0; j < m_frameData32f.size().width; ++j)
+        displacement->create(tile.size(), CV_32FC1);
+        dispRows = *displacement;
+    }
+    else if (accumulator && accumulator->hasMotionStats())
+    {
+        dispRows.create(alignedSize, CV_32FC1);
+    }
+
+    // Look up positions of a row, the row is interpolated at once
+    std::vector<float> lookupX(tile.width);
+    std::vector<float> lookupY(tile.width);
+
+    // Iterate over all pixels in the tile, (i,j) are frame coordinates
+    for (int i = tile.y; i < tile.y + tile.height; ++i)
+    {
+        // Row of the aligned data
+        int row = accumulator ? 0 : i - tile.y;
+
+        for (int j = tile.x; j < tile.x + tile.width; ++j)
         {
             // Initialize new weight and new lookup vector
             //@totalWeight: summed up weight over all features
@@ -202,6 +310,7 @@ void VideoFrame::alignFrameByFeatureBasedMorphing(const std::vector<cv::Point2f>
             cv::Point2f lookupVector = cv::Point2f(0.0,0.0);
             
             // Iterate over all feature and sum up weighted motion vector
+            // Control points standing in for several tracks weigh as much as the tracks together
             for (int f = 0; f < bestFeatures.size(); ++f)
             {
                 // distance to features in reference frame
@@ -210,13 +319,13 @@ void VideoFrame::alignFrameByFeatureBasedMorphing(const std::vector<cv::Point2f>
                 float absX = (refFtrPos.x - j) * (refFtrPos.x - j);
                 float absY = (refFtrPos.y - i) * (refFtrPos.y - i);
                 float distance = std::sqrt(absX + absY);
-               
-                // Find position of the sample point x_i
-                int xiIdx = (int) (distance / step);
-                float xi = xiIdx * step;
-                float xi1 = xi + step;
 
-                float tmpFpWeight = (distance - xi) / step * intpWeights[xiIdx+1] + (xi1 - distance) / step * intpWeights[xiIdx];
+                // Weight of the feature, inlined per kernel policy
+                float tmpFpWeight = kernel(distance);
+                if (!m_featureWeights.empty())
+                {
+                    tmpFpWeight *= m_featureWeights[bestFeatures[f]];
+                }
 
                 // Get feature position of current frame, assuming match of features
                 cv::Point2f currFtrPos = keypoints[bestFeatures[f]];
@@ -228,32 +337,217 @@ void VideoFrame::alignFrameByFeatureBasedMorphing(const std::vector<cv::Point2f>
                 totalWeight += tmpFpWeight;
             }
 
-            lookupVector *= 1.0 / totalWeight;
+            // No features, or all weights underflowed: keep the pixel in place
+            if (totalWeight > 0.0)
+            {
+                lookupVector *= 1.0 / totalWeight;
+            }
+            else
+            {
+                lookupVector = cv::Point2f(0.0, 0.0);
+            }
           
-            // Interpolate pixel look up to smooth boundaries of morphed images
-            // Mat::at<T>(y,x)
-            float x = j + lookupVector.x;
-            float y = i + lookupVector.y;
+            // Pixel look up, interpolated to smooth boundaries of morphed images
+            lookupX[j - tile.x] = j + lookupVector.x;
+            lookupY[j - tile.x] = i + lookupVector.y;
+
+            if (!dispRows.empty())
+            {
+                dispRows.at<float>(row, j - tile.x) = std::sqrt(lookupVector.x * lookupVector.x + lookupVector.y * lookupVector.y);
+            }
+        }
 
-            m_alignedFrameData32f.at<cv::Vec3f>(i,j) = interpolatedPixelLookUp(x,y);
+        if (m_compact)
+        {
+            interpolatedRowLookUpFixed(lookupX, lookupY, aligned.ptr<cv::Vec3w>(row), m_validity.ptr<float>(row));
         }
+        else
+        {
+            interpolatedRowLookUp(lookupX, lookupY, aligned.ptr<cv::Vec3f>(row), m_validity.ptr<float>(row));
+        }
+
+        if (accumulator)
+        {
+            accumulator->addRows(i - tile.y, aligned, dispRows, m_validity);
+        }
+    }
+
+    if (accumulator)
+    {
+        accumulator->countFrame();
     }
 }
 
 
-// Retrieve pixel (3-channels) at position (x,y)
+// Align a tile by a single perspective warp
+// @homography: 3x3 model mapping reference frame to frame coordinates
+// Out of bounds pixels are black and not covered, like the padded border of the morph
+void VideoFrame::alignTileByGlobalMotion(const cv::Mat& homography, const cv::Rect& tile, cv::Mat* displacement)
+{
+    // Tile pixel -> reference frame -> frame -> stored frame data
+    cv::Mat toFrame = (cv::Mat_<double>(3,3) << 1, 0, tile.x, 0, 1, tile.y, 0, 0, 1);
+    cv::Mat toData = (cv::Mat_<double>(3,3) << 1, 0, -m_origin.x, 0, 1, -m_origin.y, 0, 0, 1);
+    cv::Mat lookup = toData * homography * toFrame;
+
+    int flags = cv::INTER_LINEAR | cv::WARP_INVERSE_MAP;
+
+    if (m_compact)
+    {
+        // Warp in the source depth and rescale to the 16-bit fixed point range
+        int scale = fixedPointScale(m_frameData.depth());
+        cv::Mat warped;
+        cv::warpPerspective(m_frameData, warped, lookup, tile.size(), flags, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+        warped.convertTo(m_alignedFrameData16u, CV_16UC3, scale);
+    }
+    else
+    {
+        // Warp in the source depth and convert to 8-bit units
+        double scale = m_frameData.depth() == CV_16U ? 1.0 / 256 : 1.0;
+        cv::Mat warped;
+        cv::warpPerspective(m_frameData, warped, lookup, tile.size(), flags, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+        warped.convertTo(m_alignedFrameData32f, CV_32FC3, scale);
+    }
+
+    warpCoverage(lookup, homography, tile, m_validity, displacement);
+}
+
+
+// Coverage of the tile pixels under the lookup, the bilinear weight of the taps inside the frame data
+// Per axis the weight is 1 inside, falls off linearly over the last pixel and is 0 beyond, the coverage is the product
+// @displacement: if given, receives the magnitude of the lookup vectors |H*p - p| in frame coordinates
+void VideoFrame::warpCoverage(const cv::Mat& lookup, const cv::Mat& homography, const cv::Rect& tile, cv::Mat& validity, cv::Mat* displacement)
+{
+    cv::Mat_<double> l = lookup;
+    cv::Mat_<double> h = homography;
+    validity.create(tile.size(), CV_32FC1);
+    if (displacement)
+    {
+        displacement->create(tile.size(), CV_32FC1);
+    }
+
+    for (int i = 0; i < tile.height; ++i)
+    {
+        float* cov = validity.ptr<float>(i);
+        float* dst = displacement ? displacement->ptr<float>(i) : 0;
+
+        for (int j = 0; j < tile.width; ++j)
+        {
+            double w = l(2,0) * j + l(2,1) * i + l(2,2);
+            double u = (l(0,0) * j + l(0,1) * i + l(0,2)) / w;
+            double v = (l(1,0) * j + l(1,1) * i + l(1,2)) / w;
+            double coverageX = std::min(1.0, std::max(0.0, std::min(u + 1.0, (double) m_frameData.cols - u)));
+            double coverageY = std::min(1.0, std::max(0.0, std::min(v + 1.0, (double) m_frameData.rows - v)));
+            cov[j] = (float) (coverageX * coverageY);
+
+            if (dst)
+            {
+                double x = tile.x + j;
+                double y = tile.y + i;
+                double hw = h(2,0) * x + h(2,1) * y + h(2,2);
+                double dx = (h(0,0) * x + h(0,1) * y + h(0,2)) / hw - x;
+                double dy = (h(1,0) * x + h(1,1) * y + h(1,2)) / hw - y;
+                dst[j] = std::sqrt(dx * dx + dy * dy);
+            }
+        }
+    }
+}
+
+
+// Warp a tile strip by strip and add every strip to the accumulator
+// The aligned data only ever holds one strip of a few rows
+void VideoFrame::accumulateTileByGlobalMotion(const cv::Mat& homography, const cv::Rect& tile, FrameAccumulator& accumulator)
+{
+    const int stripRows = 16;
+
+    for (int y = 0; y < tile.height; y += stripRows)
+    {
+        cv::Rect strip(tile.x, tile.y + y, tile.width, std::min(stripRows, tile.height - y));
+
+        cv::Mat displacement;
+        alignTileByGlobalMotion(homography, strip, accumulator.hasMotionStats() ? &displacement : 0);
+
+        accumulator.addRows(y, m_compact ? m_alignedFrameData16u : m_alignedFrameData32f, displacement, m_validity);
+    }
+
+    accumulator.countFrame();
+}
+
+
+// Align a tile by an integer shift
+// @shift: frame pixel of reference pixel p is p + shift
+// Out of bounds pixels are black and not covered
+void VideoFrame::alignTileByShift(const cv::Point& shift, const cv::Rect& tile, cv::Mat* displacement)
+{
+    // Source rectangle in stored frame data coordinates and its part inside the data
+    cv::Rect src = tile + shift - m_origin;
+    cv::Rect valid = src & cv::Rect(0, 0, m_frameData.cols, m_frameData.rows);
+
+    cv::Mat shifted = cv::Mat::zeros(tile.size(), m_frameData.type());
+    m_validity = cv::Mat::zeros(tile.size(), CV_32FC1);
+    if (valid.area() > 0)
+    {
+        m_frameData(valid).copyTo(shifted(valid - src.tl()));
+        m_validity(valid - src.tl()).setTo(cv::Scalar::all(1.0));
+    }
+
+    if (m_compact)
+    {
+        shifted.convertTo(m_alignedFrameData16u, CV_16UC3, fixedPointScale(m_frameData.depth()));
+    }
+    else
+    {
+        shifted.convertTo(m_alignedFrameData32f, CV_32FC3, m_frameData.depth() == CV_16U ? 1.0 / 256 : 1.0);
+    }
+
+    // All lookup vectors are the shift
+    if (displacement)
+    {
+        displacement->create(tile.size(), CV_32FC1);
+        displacement->setTo(cv::Scalar::all(std::sqrt((float) shift.x * shift.x + (float) shift.y * shift.y)));
+    }
+}
+
+
+// Shift a tile strip by strip and add every strip to the accumulator
+void VideoFrame::accumulateTileByShift(const cv::Point& shift, const cv::Rect& tile, FrameAccumulator& accumulator)
+{
+    const int stripRows = 16;
+
+    for (int y = 0; y < tile.height; y += stripRows)
+    {
+        cv::Rect strip(tile.x, tile.y + y, tile.width, std::min(stripRows, tile.height - y));
+
+        cv::Mat displacement;
+        alignTileByShift(shift, strip, accumulator.hasMotionStats() ? &displacement : 0);
+
+        accumulator.addRows(y, m_compact ? m_alignedFrameData16u : m_alignedFrameData32f, displacement, m_validity);
+    }
+
+    accumulator.countFrame();
+}
+
+
+// Retrieve pixel (3-channels) at position (x,y) in frame coordinates, in 8-bit units
 // Boundary check performed
 cv::Vec3f VideoFrame::getPixelAt(int x, int y)
 {
-    if (x >= 0 && x < m_frameData32f.size().width && y >= 0 && y < m_frameData32f.size().height)
+    // Position within the stored frame data
+    x -= m_origin.x;
+    y -= m_origin.y;
+
+    if (x >= 0 && x < m_frameData.cols && y >= 0 && y < m_frameData.rows)
     {
         // Return pixel at (x,y)
-        return m_frameData32f.at<cv::Vec3f>(y,x);
+        if (m_frameData.depth() == CV_16U)
+        {
+            return cv::Vec3f(m_frameData.at<cv::Vec3w>(y,x)) * (1.0f / 256);
+        }
+        return cv::Vec3f(m_frameData.at<cv::Vec3b>(y,x));
     }
     else
     {
-        // Out of bounds return black
-        return cv::Vec3f(255.0, 255.0, 255.0);
+        // Out of bounds is not covered by the frame, black like the padded border
+        return cv::Vec3f(0.0, 0.0, 0.0);
     }
 }
 
@@ -265,36 +559,114 @@ float VideoFrame::euclDist(cv::Point2f p)
 }
 
 
-// Linearly interpolate look up pixels
-// Interpolate three neighbouring pixels
-// @p relative look up vector 
-// @x pixel index in x direction
-// @y pixel index in y direction
-cv::Vec3f VideoFrame::interpolatedPixelLookUp(float x, float y)
+// Fractional bits of the sampler weights
+namespace {
+
+const int kSamplerFracBits = 12;
+
+} // namespace
+
+
+// Linearly interpolate a row of look up positions
+// Bilinear interpolation of the four neighbouring pixels
+// @xs pixel positions in x direction (frame coordinates)
+// @ys pixel positions in y direction (frame coordinates)
+// Fixed point interpolation of the 8-bit (or 16-bit) frame data, the result is in 8-bit units
+void VideoFrame::interpolatedRowLookUp(std::vector<float>& xs, std::vector<float>& ys, cv::Vec3f* samples, float* coverage)
+{
+    sampleRow(xs, ys);
+
+    float norm = 1.0f / BilinearSampler<unsigned char, kSamplerFracBits>::kOne;
+    float valueNorm = m_frameData.depth() == CV_16U ? norm / 256 : norm;
+    for (int j = 0; j < xs.size(); ++j)
+    {
+        const int* acc = &m_rowSamples[3 * j];
+        coverage[j] = m_rowCoverage[j] * norm;
+        samples[j] = cv::Vec3f(acc[0] * valueNorm, acc[1] * valueNorm, acc[2] * valueNorm);
+    }
+}
+
+
+// Linearly interpolate a row of look up positions in fixed point arithmetic
+// The result is scaled to 16 bits, i.e. 8 fractional bits for 8-bit sources
+void VideoFrame::interpolatedRowLookUpFixed(std::vector<float>& xs, std::vector<float>& ys, cv::Vec3w* samples, float* coverage)
+{
+    sampleRow(xs, ys);
+
+    int scale = fixedPointScale(m_frameData.depth());
+    float norm = 1.0f / BilinearSampler<unsigned char, kSamplerFracBits>::kOne;
+    for (int j = 0; j < xs.size(); ++j)
+    {
+        const int* acc = &m_rowSamples[3 * j];
+        coverage[j] = m_rowCoverage[j] * norm;
+
+        // Rescale to the 16-bit range with rounding
+        for (int ch = 0; ch < 3; ++ch)
+        {
+            long long v = ((long long) acc[ch] * scale + (1 << (kSamplerFracBits - 1))) >> kSamplerFracBits;
+            samples[j][ch] = (unsigned short) std::min(v, 65535LL);
+        }
+    }
+}
+
+
+// Sample the frame data at a row of look up positions into m_rowSamples and m_rowCoverage
+// The sampler takes the whole row, so it can compute the tap weights of several pixels at once
+void VideoFrame::sampleRow(std::vector<float>& xs, std::vector<float>& ys)
 {
-    // Absolute position of interpolation look up
-    int ix = (int) x;
-    int iy = (int) y;
+    int n = xs.size();
+    if (n == 0)
+    {
+        return;
+    }
+    m_rowSamples.resize(3 * n);
+    m_rowCoverage.resize(n);
 
-    // Calculate fractional part
-    float tailX = x - ix;
-    float tailY = y - iy;
+    // Positions within the stored frame data
+    for (int j = 0; j < n; ++j)
+    {
+        xs[j] -= m_origin.x;
+        ys[j] -= m_origin.y;
+    }
 
-    // Interpolate with neighbour cells (right, lower, lower-right)
-    cv::Vec3f resVec = (1.0 - tailY) * ((1.0 - tailX) * getPixelAt(ix,iy) + tailX * getPixelAt(ix+1,iy)) + tailY * ((1.0 - tailX) * getPixelAt(ix,iy+1) + tailX * getPixelAt(ix+1,iy+1));
+    if (m_frameData.depth() == CV_16U)
+    {
+        BilinearSampler<unsigned short, kSamplerFracBits>(m_frameData).sampleRow(&xs[0], &ys[0], n, &m_rowSamples[0], &m_rowCoverage[0]);
+    }
+    else
+    {
+        BilinearSampler<unsigned char, kSamplerFracBits>(m_frameData).sampleRow(&xs[0], &ys[0], n, &m_rowSamples[0], &m_rowCoverage[0]);
+    }
+}
 
-    return resVec;                
+
+// Select the weight kernel of the feature based morphing: powexp, gaussian, idw or wendland
+// @powerExpKernel: table of the powexp kernel shared by all frames, it has to outlive the morphing
+void VideoFrame::setWeightKernel(const std::string& weightKernel, const PowerExpKernel* powerExpKernel)
+{
+    m_weightKernel = weightKernel;
+    m_powerExpKernel = powerExpKernel;
+}
+
+
+// Set per keypoint weights of the feature based morphing
+void VideoFrame::setFeatureWeights(const std::vector<float>& featureWeights)
+{
+    m_featureWeights = featureWeights;
 }
 
 
-// Weighting function (mirrored sigmoidal function)
-float VideoFrame::weightFunction(float r)
+// Return per keypoint weights of the feature based morphing
+const std::vector<float>& VideoFrame::getFeatureWeights() const
 {
-    // Max distance in one dimension
-    float rMax = std::max(m_frameData32f.size().width, m_frameData32f.size().height); 
-     
-    // Power distance function 
-    return std::pow(0.9, (100 * r) / rMax) + 10 * std::exp(-0.1 / rMax * r * r) + 1; 
+    return m_featureWeights;
+}
+
+
+// Get coverage of the aligned frame data
+cv::Mat& VideoFrame::getValidity()
+{
+    return m_validity;
 }
 
 
@@ -305,10 +677,20 @@ cv::Mat& VideoFrame::getFrameData()
     return m_frameData;
 }
 
-// Get frame data
-cv::Mat& VideoFrame::getFrameData32f()
+// Get 8-bit grayscale frame data, as needed by feature detection and optical flow
+void VideoFrame::getGreyFrameData(cv::Mat& greyFrameData)
 {
-    return m_frameData32f;
+    // Frames kept for tracking only are grey already
+    if (m_frameData.channels() == 1)
+    {
+        m_frameData.copyTo(greyFrameData);
+        return;
+    }
+    cv::cvtColor(m_frameData, greyFrameData, cv::COLOR_RGB2GRAY);
+    if (greyFrameData.depth() == CV_16U)
+    {
+        greyFrameData.convertTo(greyFrameData, CV_8U, 1.0 / 256);
+    }
 }
 
 // Get aligned frame data
@@ -317,6 +699,12 @@ cv::Mat& VideoFrame::getAlignedFrameData32f()
     return m_alignedFrameData32f;
 }
 
+// Get aligned frame data in fixed point
+cv::Mat& VideoFrame::getAlignedFrameData16u()
+{
+    return m_alignedFrameData16u;
+}
+
 // Get feature data
 std::vector<FFeature>& VideoFrame::getFeatureData()
 {
@@ -336,3 +724,25 @@ std::vector<unsigned char>& VideoFrame::getStatusVec()
 {
     return m_status;
 }
+
+
+// Get size of the full frame
+cv::Size VideoFrame::getFrameSize() const
+{
+    return m_frameSize;
+}
+
+
+// Get position of the frame data within the full frame
+cv::Point VideoFrame::getOrigin() const
+{
+    return m_origin;
+}
+
+
+// Scale from source pixel values of the given depth to the 16-bit fixed point range
+// 8-bit sources get 8 fractional bits
+int VideoFrame::fixedPointScale(int depth)
+{
+    return depth == CV_16U ? 1 : 256;
+}
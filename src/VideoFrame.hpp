@@ -17,15 +17,22 @@
 #include "FeatureTrackingParams.hpp"
 #include "FFeature.cpp"
 
+class FrameAccumulator;
+class PowerExpKernel;
+
 class VideoFrame {
 public:
     // Empty constructor
-    VideoFrame() {};
+    VideoFrame() : m_compact(false), m_weightKernel("powexp"), m_powerExpKernel(0) {};
     // ~VideoFrame();
 
     // Constructor takes a frame as input
     VideoFrame(cv::Mat&);
 
+    // Constructor keeps only a region of the frame, used by the tiled renderer
+    // @compact: align into 16-bit fixed point instead of CV_32FC3
+    VideoFrame(cv::Mat&, const cv::Rect&, bool = false);
+
     // Refine keypoints on search domain
     int refineGoodFeatures(FeatureTrackingParams, int[]);
 
@@ -35,22 +42,59 @@ public:
     // Find best features based on the cummulated erros & return mean motion vector
     void findBestFeatures(std::vector<int>&);
 
+    // Combine the feature trajectories of a frame tracked backward from the same reference frame
+    void combineFeatureData(const VideoFrame&);
+
     // Aligns frame i to frame i-1 (previous)
-    void alignFrameByFeatureBasedMorphing(const std::vector<cv::Point2f>&, std::vector<cv::Point2f>&, std::vector<int>&);
+    void alignFrameByFeatureBasedMorphing(const std::vector<cv::Point2f>&, std::vector<cv::Point2f>&, std::vector<int>&, cv::Mat* = 0);
+
+    // Aligns a tile (in frame coordinates) of frame i to frame i-1
+    void alignTileByFeatureBasedMorphing(const std::vector<cv::Point2f>&, std::vector<cv::Point2f>&, std::vector<int>&, const cv::Rect&, cv::Mat* = 0);
+
+    // Aligns a tile by a global 3x3 motion model mapping reference to frame coordinates
+    void alignTileByGlobalMotion(const cv::Mat&, const cv::Rect&, cv::Mat* = 0);
+
+    // Aligns a tile by an integer shift of the frame, a copy without resampling
+    void alignTileByShift(const cv::Point&, const cv::Rect&, cv::Mat* = 0);
+
+    // Morphs a tile and adds the samples straight into the accumulator, the aligned tile is never stored
+    void accumulateTileByFeatureBasedMorphing(const std::vector<cv::Point2f>&, std::vector<cv::Point2f>&, std::vector<int>&, const cv::Rect&, FrameAccumulator&);
+
+    // Warps a tile strip by strip and adds the samples straight into the accumulator
+    void accumulateTileByGlobalMotion(const cv::Mat&, const cv::Rect&, FrameAccumulator&);
+
+    // Shifts a tile strip by strip and adds the samples straight into the accumulator
+    void accumulateTileByShift(const cv::Point&, const cv::Rect&, FrameAccumulator&);
 
-    // Pixel look up with boundary check
+    // Select the weight kernel of the feature based morphing
+    // The powexp kernel uses the given table if it fits the frame size, otherwise it is tabulated per morphed tile
+    void setWeightKernel(const std::string&, const PowerExpKernel* = 0);
+
+    // Set per keypoint weights scaling the kernel weights of the feature based morphing, empty: all 1
+    void setFeatureWeights(const std::vector<float>&);
+
+    // Return per keypoint weights of the feature based morphing, empty if all are 1
+    const std::vector<float>& getFeatureWeights() const;
+
+    // Pixel look up with boundary check, black outside of the frame data
     cv::Vec3f getPixelAt(int, int);
     
     // Getter
     // Return frame data
     cv::Mat& getFrameData();
 
-    // Return frame data 32 float format
-    cv::Mat& getFrameData32f();
+    // Return 8-bit grayscale frame data
+    void getGreyFrameData(cv::Mat&);
 
     // Return aligned frame data 32 float format
     cv::Mat& getAlignedFrameData32f();
 
+    // Return aligned frame data 16 bit fixed point format (compact frames only)
+    cv::Mat& getAlignedFrameData16u();
+
+    // Return coverage of the aligned frame data by the frame, CV_32FC1 in [0,1]
+    cv::Mat& getValidity();
+
     // Return feature data
     std::vector<FFeature>& getFeatureData();
 
@@ -60,28 +104,79 @@ public:
     // Return status vector
     std::vector<unsigned char>& getStatusVec();
 
+    // Return size of the full frame
+    cv::Size getFrameSize() const;
+
+    // Return position of the stored frame data within the full frame
+    cv::Point getOrigin() const;
+
+    // Scale from source pixel values to the 16-bit fixed point range
+    static int fixedPointScale(int);
+
 private:
 
+    // Initialize frame data containers
+    void init(const cv::Mat&, bool);
+
     // Euclidean distance of vector
     float euclDist(cv::Point2f);
 
-    // Linearly interpolate look up pixels
-    // four neighbourhood interpolation
-    cv::Vec3f interpolatedPixelLookUp(float, float);
-    
-    // Weighting function need by feature based morphing algorithm
-    float weightFunction(float);
+    // Feature based morphing of a tile into the aligned frame data or, row by row, into an accumulator
+    void morphTile(const std::vector<cv::Point2f>&, std::vector<cv::Point2f>&, std::vector<int>&, const cv::Rect&, FrameAccumulator*, cv::Mat*);
 
-private:
-        // cv::Mat container for the frame data
-    cv::Mat m_frameData;
+    // Feature based morphing of a tile with a weight kernel policy (WeightKernels.hpp)
+    template<typename Kernel>
+    void morphTileWithKernel(const Kernel&, const std::vector<cv::Point2f>&, std::vector<cv::Point2f>&, std::vector<int>&, const cv::Rect&, FrameAccumulator*, cv::Mat*);
+
+    // Linearly interpolate a row of look up positions (frame coordinates, shifted in place)
+    // four neighbourhood interpolation in fixed point, result in 8-bit units, coverage of the samples in [0,1]
+    void interpolatedRowLookUp(std::vector<float>&, std::vector<float>&, cv::Vec3f*, float*);
+
+    // Linearly interpolate a row of look up positions in fixed point arithmetic, result scaled to 16 bits
+    // reads CV_8UC3 or CV_16UC3 frame data directly, coverage of the samples in [0,1]
+    void interpolatedRowLookUpFixed(std::vector<float>&, std::vector<float>&, cv::Vec3w*, float*);
 
+    // Sample the frame data at a row of look up positions (frame coordinates, shifted in place) into the row buffers
+    void sampleRow(std::vector<float>&, std::vector<float>&);
+
+    // Coverage of the aligned pixels of a tile by the frame data under a 3x3 lookup (tile pixel to frame data), optionally displacement magnitudes
+    void warpCoverage(const cv::Mat&, const cv::Mat&, const cv::Rect&, cv::Mat&, cv::Mat*);
+
+private:
     // cv::Mat container for the frame data
-    cv::Mat m_frameData32f;
+    cv::Mat m_frameData;
 
     // cv::Mat container for aligned frame data of type CV_32FC3
     cv::Mat m_alignedFrameData32f;
 
+    // cv::Mat container for aligned frame data of type CV_16UC3 (compact frames)
+    cv::Mat m_alignedFrameData16u;
+
+    // Coverage of the aligned frame data by the frame, CV_32FC1 in [0,1], 0 where the lookup left the frame
+    cv::Mat m_validity;
+
+    // Row buffers of the sampler: per channel samples and coverages in fixed point
+    std::vector<int> m_rowSamples;
+    std::vector<int> m_rowCoverage;
+
+    // Compact frames are aligned into 16-bit fixed point
+    bool m_compact;
+
+    // Size of the full frame, the frame data may only cover a region of it
+    cv::Size m_frameSize;
+
+    // Top left corner of the frame data within the full frame
+    cv::Point m_origin;
+
+    // Weight kernel of the feature based morphing
+    std::string m_weightKernel;
+
+    // Shared table of the powexp kernel, not owned, null if none is given
+    const PowerExpKernel* m_powerExpKernel;
+
+    // Per keypoint weights of the feature based morphing (e.g. tracks merged into a control point), empty: all 1
+    std::vector<float> m_featureWeights;
+
     // Container for keypoints
     std::vector<cv::Point2f> m_keypoints;
 
@@ -7,154 +7,740 @@
  * **********************************/
 
 // C++ std libraries
+#include <chrono>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
 
 // #include <gflags/gflags.h>
 
+// OpenCV libraries
+#include <opencv2/imgproc/imgproc.hpp>
+
 // User libraries
 #include "VideoProcessing.hpp"
 #include "VideoFrame.hpp"
 #include "Drawing.hpp"
+#include "TileWriter.hpp"
+#include "MappedFile.hpp"
+#include "file_utils.h"
 #include "Timer.hpp"
+#include "MemoryStats.hpp"
+#include "VideoExporter.hpp"
+
+namespace
+{
+    // Standard deviation of the blur of the alpha mask in pixels
+    const double kAlphaBlurSigma = 2.0;
+
+    // Radius of the blur kernel, the rows a tiled band needs of its neighbouring bands
+    const int kAlphaBlurApron = 8;
+}
 
 // Constructor
-VideoProcessing::VideoProcessing(const std::string& videoFilePath, const std::string& videoName) : m_featureTracking(videoName), m_videoCapture(videoFilePath) 
+VideoProcessing::VideoProcessing(const VideoProcessingParams& params, ThreadPool* pool) : m_stage(kClosed), m_pool(pool), m_refIndex(0), m_numFrames(0), m_featureTracking(params.outputDir + "raw/")
+{
+    configure(params);
+}
+
+
+// Configure the session
+// The settings apply from the next opened clip on
+void VideoProcessing::configure(const VideoProcessingParams& params)
+{
+    int warpThreads = m_params.warpThreads;
+    m_params = params;
+
+    // Define number of frames to work with
+    // The averaged images contains m_numFrames + (reference Frame) frames
+    m_numFrames = m_params.numFrames;
+
+    // Per pixel histograms are only affordable for a band of tiles at a time
+    if (FrameAccumulator::usesHistograms(m_params.blendMode) && m_params.tileSize <= 0)
+    {
+        m_params.tileSize = 64;
+        std::cout << m_params.blendMode << " blending renders in tiles of " << m_params.tileSize << " pixels" << std::endl;
+    }
+
+    // Tiles are written as 8-bit PPM while rendering, compact sums are integers
+    if (m_params.tileSize > 0 && m_params.hdrFormat != "none")
+    {
+        std::cout << "tiled rendering writes 8-bit tiles only, hdr is ignored" << std::endl;
+    }
+    // Every window frame, its sub-frames and the reference frame add a sample per pixel
+    long long numSamples = 1 + (long long) std::max(0, m_numFrames) * (1 + std::max(0, m_params.subFrames));
+    if (m_params.compact && numSamples > FrameAccumulator::kMaxCompactFrames)
+    {
+        m_params.compact = false;
+        std::cout << numSamples << " frames overflow a compact sum (at most " << FrameAccumulator::kMaxCompactFrames << "), the frames are summed up in float" << std::endl;
+    }
+    if (m_params.tileSize <= 0 && m_params.compact && m_params.mappedAccumulator)
+    {
+        std::cout << "compact sums are integers and stay on the heap, mapped_accumulator is ignored" << std::endl;
+    }
+    if (m_params.tileSize > 0 && m_params.convergeThreshold > 0.0)
+    {
+        std::cout << "tiled rendering aligns every frame once per band, converge is ignored" << std::endl;
+    }
+    if (m_params.tileSize > 0 && m_params.subFrames > 0)
+    {
+        std::cout << "tiled rendering aligns decoded frames only, sub_frames is ignored" << std::endl;
+    }
+    if (m_params.tileSize > 0 && m_params.exportVideo)
+    {
+        std::cout << "tiled rendering never holds a whole aligned frame, export_video is ignored" << std::endl;
+    }
+
+    // A shared pool is sized by its owner
+    if (!m_pool || (m_ownPool && m_params.warpThreads != warpThreads))
+    {
+        // An open image sequence decodes on the old pool
+        m_frameSource.reset();
+        m_ownPool.reset();
+        m_ownPool.reset(new ThreadPool(m_params.warpThreads));
+        m_pool = m_ownPool.get();
+    }
+    m_featureTracking.setThreadPool(m_pool);
+}
+
+
+// Process a clip, all stages in turn
+void VideoProcessing::process(const std::string& videoFilePath, const std::string& videoName)
 {
     // Declare and start timer
     Timer timer;
     timer.start();
 
-    m_filePath = videoFilePath;
-    
-    // File name to which video gets saved
-    m_fileName = videoName;
+    // The counters of an own pool cover this clip, a shared pool also runs other clips
+    if (m_ownPool)
+    {
+        m_ownPool->resetStats();
+    }
 
-    // Define number of frames to work with
-    // The averaged images contains m_numFrames + (reference Frame) frames
-    m_numFrames = 30;
-   
-    std::cout << "start computation with: " << m_numFrames << " frames" << std::endl;
+    open(videoFilePath, videoName);
 
     // Find feature motion that is later used for optical flow computation and video stabilization
-    findFeatureMotion();
+    track();
 
-    Drawing::saveMotionVecs(m_refFrame, m_keypoints, m_bestFeatures, false, m_fileName + "_motionVecs");
-    
-    // Stabilize frames 
-    stabilizeFrames(m_avgFrame);
+    // Stabilize frames, tiled rendering blends and writes the tiles right away
+    stabilize();
 
     // Average over all aligned frames
-    averagingFrames();
+    blend();
 
-    // Create alpha mask for global motion 
-    //createAlphaMask(startFrame, endFrame);
-    //motionBlur(startFrame, endFrame, cv::Point2f(0.0, 0.0));
+    exportResults();
 
     // Stop timer and print time
     double elapsedTime = timer.stop();
     std::cout << "computational time: " << elapsedTime << " seconds" << std::endl;
-    
+    if (m_ownPool)
+    {
+        m_ownPool->printStats("this clip");
+    }
+}
+
+
+// Open a clip
+void VideoProcessing::open(const std::string& videoFilePath, const std::string& videoName)
+{
+    m_stage = kClosed;
+    m_stageSeconds.clear();
+    m_keypoints.clear();
+    m_frameIndices.clear();
+    m_bestFeatures.clear();
+
+    // The blended image of the previous clip may be a view of its mapped sum, which the next clip unmaps
+    // Heap outputs keep their memory, the next clip of the same size blends into it
+    if (m_accumulator.isMapped())
+    {
+        m_avgFrame.release();
+    }
+
+    m_filePath = videoFilePath;
+
+    // User crop, set once the frame size is known
+    m_crop = cv::Rect();
+
+    // File name to which video gets saved
+    m_fileName = videoName;
+
+    // Create output directories, every job writes to its own output directory
+    base::FileUtils::CreateDirRecursively(m_params.outputDir + "raw/");
+    m_featureTracking.setOutputPrefix(m_params.outputDir + "raw/" + videoName);
+
+    // Open video capture
+    if (!openVideo(m_filePath))
+    {
+        throw std::runtime_error("cannot open video " + m_filePath);
+    }
+
+    // The user crop is clipped to the frame, the first frame tells its size
+    if (m_params.cropWidth != 0 || m_params.cropHeight != 0)
+    {
+        cv::Mat firstFrame;
+        if (!m_frameSource->read(firstFrame) || firstFrame.empty())
+        {
+            throw std::runtime_error("cannot read video " + m_filePath);
+        }
+
+        cv::Rect userCrop(m_params.cropX, m_params.cropY, m_params.cropWidth, m_params.cropHeight);
+        m_crop = userCrop & cv::Rect(0, 0, firstFrame.cols, firstFrame.rows);
+        if (m_crop.area() <= 0)
+        {
+            throw std::runtime_error("crop rectangle lies outside of the frame of " + m_filePath);
+        }
+        if (m_crop != userCrop)
+        {
+            std::cout << "crop clipped to the frame: " << m_crop.width << "x" << m_crop.height << " at " << m_crop.x << "," << m_crop.y << std::endl;
+        }
+
+        closeVideo();
+        if (!openVideo(m_filePath))
+        {
+            throw std::runtime_error("cannot open video " + m_filePath);
+        }
+    }
+
+    std::cout << "start computation with: " << m_numFrames << " frames" << std::endl;
+
+    m_stage = kOpened;
+}
+
+
+// Track features
+void VideoProcessing::track()
+{
+    requireStage(kOpened, "track");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        MemoryStage stage("tracking");
+        findFeatureMotion();
+        Drawing::saveMotionVecs(m_refFrame, m_keypoints, m_bestFeatures, false, m_params.outputDir + m_fileName + "_motionVecs");
+    }
+    stageDone("tracking", start);
+
+    m_stage = kTracked;
+}
+
+
+// Align the window frames
+void VideoProcessing::stabilize()
+{
+    requireStage(kTracked, "stabilize");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if (m_params.tileSize > 0)
+    {
+        // Stabilize and average tile by tile
+        MemoryStage stage("tiled");
+        stabilizeFramesTiled();
+        stageDone("tiled", start);
+
+        m_avgFrame.release();
+        m_stage = kExported;
+    }
+    else
+    {
+        MemoryStage stage("stabilizing");
+        stabilizeFrames(m_accumulator);
+        stageDone("stabilizing", start);
+
+        m_stage = kStabilized;
+    }
+}
+
+
+// Blend the aligned frames
+void VideoProcessing::blend()
+{
+    // Tiles are blended while rendering
+    if (m_stage == kExported && m_params.tileSize > 0)
+    {
+        return;
+    }
+    requireStage(kStabilized, "blend");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        MemoryStage stage("blending");
+
+        // Divide by number of frames
+        // Compact sums are integers in the 16-bit fixed point range
+        // A mapped sum is divided in place, its file becomes the HDR average and the mean is a view of it
+        if (m_accumulator.isMapped())
+        {
+            m_accumulator.normalize();
+        }
+        m_accumulator.blend(m_avgFrame);
+
+        // Create alpha mask of motion and blend the long exposure over the reference frame
+        if (m_params.alphaMask)
+        {
+            createAlphaMask(m_accumulator, m_alphaMask);
+            motionBlur(m_avgFrame, m_refFrame.getFrameData(), m_alphaMask, m_composite);
+        }
+
+        std::cout << "averaging done..." << std::endl;
+    }
+    stageDone("blending", start);
+
+    m_stage = kBlended;
+}
+
+
+// Write the results of the clip
+void VideoProcessing::exportResults()
+{
+    // Tiles are written while rendering
+    if (m_stage == kExported && m_params.tileSize > 0)
+    {
+        return;
+    }
+    requireStage(kBlended, "export");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        MemoryStage stage("export");
+
+        Drawing::saveImg(m_avgFrame, m_params.outputDir + m_fileName + blendSuffix());
+
+        // The mapped average already is the raw float output
+        if (m_params.hdrFormat == "float" && m_accumulator.isMapped() && m_params.blendMode == "mean")
+        {
+            std::cout << m_params.outputDir << m_fileName << "_avg.f32 (" << m_avgFrame.cols << "x" << m_avgFrame.rows << " BGR float) holds the average" << std::endl;
+        }
+        else if (m_params.hdrFormat != "none")
+        {
+            Drawing::saveHdrImg(m_avgFrame, m_params.outputDir + m_fileName + blendSuffix(), m_params.hdrFormat);
+        }
+
+        if (m_params.alphaMask)
+        {
+            Drawing::saveImg(m_alphaMask * 255.0, m_params.outputDir + m_fileName + "_alpha");
+            Drawing::saveImg(m_composite, m_params.outputDir + m_fileName + "_composite");
+        }
+    }
+    stageDone("export", start);
+
+    m_stage = kExported;
+}
+
+
+// Blended image of the last clip
+const cv::Mat& VideoProcessing::blendedImage() const
+{
+    return m_avgFrame;
+}
+
+
+// Throw if the current clip has not reached the given stage
+void VideoProcessing::requireStage(Stage stage, const std::string& name) const
+{
+    if (m_stage < stage)
+    {
+        throw std::runtime_error(name + " called before the previous stages of the clip");
+    }
 }
 
 
 // Find feature motion
+// Features are tracked forward and backward from the reference frame in the middle of the video,
+// each direction with its own frame source
 void VideoProcessing::findFeatureMotion()
 {
-    // Open video capture
-    openVideo(m_filePath); 
+    // Reopen the video if a previous track left it closed
+    if (!m_frameSource && !openVideo(m_filePath))
+    {
+        throw std::runtime_error("cannot open video " + m_filePath);
+    }
 
-    // Initialize m_keypoints vector for all keypoints for all frames
-    m_keypoints = std::vector<std::vector<cv::Point2f> >(m_numFrames);
-    
-    int frameCount = m_videoCapture.get(cv::CAP_PROP_FRAME_COUNT);
-    m_startFrame = frameCount/2 - m_numFrames/2;
+    // The backward tracking decodes on its own
+    std::unique_ptr<FrameSource> backwardSource = FrameSource::open(m_filePath, m_params, m_pool, m_crop);
+    if (!backwardSource)
+    {
+        throw std::runtime_error("cannot open video " + m_filePath);
+    }
+
+    int frameCount = m_frameSource->frameCount();
+    m_refIndex = frameCount/2;
 
-    // Jump to start frame index - 1
-    jumpToFrame(m_startFrame - 1);
+    // Jump to reference frame index
+    jumpToFrame(m_refIndex);
 
     // Create first video frame (reference frame)
     cv::Mat tmpFrame;
-    m_videoCapture.read(tmpFrame);
+    m_frameSource->read(tmpFrame);
     m_refFrame = VideoFrame(tmpFrame);
 
     // Compute good features on reference frame
     // @domainSplit enabled
     int numFeats = m_featureTracking.computeGoodFeatures(m_refFrame);
-    std::cout << numFeats << " good features detected in reference frame " << m_startFrame << std::endl;
+    std::cout << numFeats << " good features detected in reference frame " << m_refIndex << std::endl;
 
     // Optical flow calculation
-    m_featureTracking.initialMotion(m_refFrame, m_videoCapture, m_numFrames, m_bestFeatures);
-    
-    // Close video stream
-    closeVideo();    
-    
-    // Open video
-    openVideo(m_filePath);
+    m_featureTracking.initialMotion(m_refFrame, *m_frameSource, *backwardSource, m_refIndex, m_numFrames, m_bestFeatures);
+
+    if (m_params.cropAuto && m_crop.area() == 0)
+    {
+        // Crop to the range of the best features plus margin, from here on only the crop is decoded, tracked and warped
+        cv::Rect range = FeatureTracking::bestFeatureRange(m_refFrame, m_bestFeatures);
+        cv::Size frameSize = m_refFrame.getFrameSize();
+        m_crop = cv::Rect(range.x - m_params.cropMargin, range.y - m_params.cropMargin, range.width + 2 * m_params.cropMargin, range.height + 2 * m_params.cropMargin) & cv::Rect(0, 0, frameSize.width, frameSize.height);
+        std::cout << "crop: " << m_crop.width << "x" << m_crop.height << " at " << m_crop.x << "," << m_crop.y << " (" << (100.0 * m_crop.area()) / (frameSize.width * frameSize.height) << "% of the frame)" << std::endl;
+
+        cv::Mat refCrop = m_refFrame.getFrameData()(m_crop).clone();
+        m_refFrame = VideoFrame(refCrop);
+        closeVideo();
+        backwardSource.reset();
+        openVideo(m_filePath);
+        backwardSource = FrameSource::open(m_filePath, m_params, m_pool, m_crop);
+        if (!m_frameSource || !backwardSource)
+        {
+            throw std::runtime_error("cannot open video " + m_filePath);
+        }
+
+        // The crop is the range the refinement would mask, features are detected on all of it
+        numFeats = m_featureTracking.computeGoodFeatures(m_refFrame);
+    }
+    else
+    {
+        // Compute good features on reference frame on subdomain
+        numFeats = m_featureTracking.refineGoodFeatures(m_refFrame, m_bestFeatures);
+    }
+    std::cout << numFeats << " good features detected in reference frame " << m_refIndex << std::endl;
 
-    // Jump to start frame index - 1
-    jumpToFrame(m_startFrame);
+    // Refined optical flow calculation on a subdomain of the original frame
+    m_featureTracking.refinedMotion(m_refFrame, *m_frameSource, *backwardSource, m_refIndex, m_numFrames, m_bestFeatures, m_keypoints, m_frameIndices);
 
-    // Compute good features on reference frame on subdomain
-    numFeats = m_featureTracking.refineGoodFeatures(m_refFrame, m_bestFeatures);
-    std::cout << numFeats << " good features detected in reference frame " << m_startFrame << std::endl;
+    std::cout << "tracked window: frames " << m_frameIndices.front() << " - " << m_frameIndices.back() << " around reference frame " << m_refIndex << std::endl;
 
-    // Refined optical flow calculation on a subdomain of the original frame
-    m_featureTracking.refinedMotion(m_refFrame, m_videoCapture, m_numFrames, m_bestFeatures, m_keypoints);
+    // Merge the best features into weighted control points, the morph cost per pixel grows with their number
+    if (m_params.controlPoints > 0)
+    {
+        FeatureTracking::clusterControlPoints(m_refFrame, m_keypoints, m_bestFeatures, m_params.controlPoints, m_params.controlPointMotion);
+    }
 
-    // Close video stream
+    // Close video streams
+    backwardSource->printStats();
     closeVideo();
 }
 
 // Video (frame) stabilization
-// Always start from startFrame = startFrame + 1 to align current to previous frame
-void VideoProcessing::stabilizeFrames(cv::Mat& avgFrame)
+// All window frames (m_frameIndices) are aligned to the reference frame
+void VideoProcessing::stabilizeFrames(FrameAccumulator& accumulator)
 {
 
     // Prepare for averaging
-    // Add reference frame to the avgFrame image
-    m_refFrame.getFrameData32f().copyTo(avgFrame);
+    // Add reference frame to the accumulator
+    accumulator.setBlendMode(m_params.blendMode, m_params.trimFraction);
+    accumulator.mapTo(m_params.mappedAccumulator && !m_params.compact ? m_params.outputDir + m_fileName + "_avg.f32" : "");
+    accumulator.init(m_refFrame.getFrameData(), m_params.compact, m_params.alphaMask);
 
     // Open the video stream
-    openVideo(m_filePath);
+    if (!openVideo(m_filePath))
+    {
+        throw std::runtime_error("cannot open video " + m_filePath);
+    }
 
-    // Jump to reference frame index
-    jumpToFrame(m_startFrame);
+    // Jump to the first window frame
+    jumpToFrame(m_frameIndices.front());
 
     // Construct and initialize the video stabilizing object
     // Warp all frames to the reference frame 
     // Start stabilizing from the subsequent frame
-    VideoStabilizing vidStab = VideoStabilizing();
+    VideoStabilizing vidStab(m_params, m_pool);
+
+    // The stabilized clip is encoded on its own thread while the frames are aligned
+    std::unique_ptr<VideoExporter> exporter;
+    if (m_params.exportVideo)
+    {
+        double fps = m_params.exportFps > 0.0 ? m_params.exportFps : m_frameSource->frameRate() > 0.0 ? m_frameSource->frameRate() : 30.0;
+        exporter.reset(new VideoExporter(m_params.outputDir + m_fileName + "_stabilized.avi", m_params.exportCodec, fps, m_refFrame.getFrameSize(), m_params.exportQueue));
+        if (exporter->isOpen())
+        {
+            // The reference frame takes its place between the window frames before and after it
+            int refPosition = std::lower_bound(m_frameIndices.begin(), m_frameIndices.end(), m_refIndex) - m_frameIndices.begin();
+            vidStab.setExporter(exporter.get(), refPosition);
+        }
+    }
    
     // Perform video stabilization
-    vidStab.stabilizeUsingMorphing(m_refFrame, m_videoCapture, m_numFrames, m_keypoints, m_bestFeatures, avgFrame);
+    vidStab.stabilizeUsingMorphing(m_refFrame, *m_frameSource, m_frameIndices, m_keypoints, m_bestFeatures, accumulator);
+
+    if (exporter)
+    {
+        exporter->close();
+    }
     
     std::cout << "video stabilization done..." << std::endl;
 
 }
 
-// Averaging aligned frames
-void VideoProcessing::averagingFrames()
+// Tiled video stabilization
+// The output is rendered in bands of tiles, every band decodes the frames once
+// and keeps only the tile accumulators plus the source regions they sample from
+void VideoProcessing::stabilizeFramesTiled()
+{
+
+    cv::Size frameSize = m_refFrame.getFrameSize();
+    int tileSize = m_params.tileSize;
+
+    // A lookup never leaves the tile by more than the maximum feature displacement
+    // One additional pixel for the bilinear interpolation
+    float maxDisp = VideoStabilizing::maxDisplacement(m_refFrame.getKeypoints(), m_keypoints, m_bestFeatures);
+    int margin = (int) std::ceil(maxDisp) + 2;
+
+    std::cout << "tiled rendering with tile size " << tileSize << ", margin " << margin << std::endl;
+
+    TileWriter tileWriter(m_params.outputDir + m_fileName + blendSuffix() + ".ppm", frameSize);
+    if (!tileWriter.isOpen())
+    {
+        return;
+    }
+
+    // Alpha mask and composite are written tile by tile as well
+    std::unique_ptr<TileWriter> alphaWriter, compositeWriter;
+    if (m_params.alphaMask)
+    {
+        alphaWriter.reset(new TileWriter(m_params.outputDir + m_fileName + "_alpha.ppm", frameSize));
+        compositeWriter.reset(new TileWriter(m_params.outputDir + m_fileName + "_composite.ppm", frameSize));
+    }
+
+    // The average of every tile goes to a memory mapped float frame in the layout of the mapped sum of untiled rendering
+    MappedFile mappedAvg;
+    cv::Mat mappedAvgFrame;
+    std::string mappedAvgPath = m_params.outputDir + m_fileName + "_avg.f32";
+    if (m_params.mappedAccumulator)
+    {
+        if (mappedAvg.createReadWrite(mappedAvgPath, (size_t) frameSize.area() * 3 * sizeof(float)))
+        {
+            mappedAvgFrame = cv::Mat(frameSize, CV_32FC3, mappedAvg.data());
+        }
+        else
+        {
+            std::cout << "Cannot map " << mappedAvgPath << ", the tile averages are not kept" << std::endl;
+        }
+    }
+
+    VideoStabilizing vidStab(m_params, m_pool);
+
+    // The blur of the alpha mask reaches kAlphaBlurApron rows into the neighbouring bands,
+    // so a band is blurred and composited once the raw alpha of the rows below it is known
+    struct AlphaBand
+    {
+        int y;
+        std::vector<cv::Rect> tiles;
+        std::vector<cv::Mat> avgTiles;
+    };
+    std::vector<AlphaBand> pendingBands;
+
+    // Raw alpha rows from alphaTop on, as far as the bands are rendered
+    cv::Mat alphaRows;
+    int alphaTop = 0;
+
+    for (int y = 0; y < frameSize.height; y += tileSize)
+    {
+        // Tiles of the current band
+        std::vector<cv::Rect> tiles;
+        for (int x = 0; x < frameSize.width; x += tileSize)
+        {
+            tiles.push_back(cv::Rect(x, y, std::min(tileSize, frameSize.width - x), std::min(tileSize, frameSize.height - y)));
+        }
+
+        // Prepare for averaging
+        // Add reference frame to the tile sums
+        std::vector<FrameAccumulator> tileSums(tiles.size());
+        for (int t = 0; t < tiles.size(); ++t)
+        {
+            tileSums[t].setBlendMode(m_params.blendMode, m_params.trimFraction);
+            tileSums[t].init(m_refFrame.getFrameData()(tiles[t]), m_params.compact, m_params.alphaMask);
+        }
+
+        // Open the video stream and jump to the first window frame
+        if (!openVideo(m_filePath))
+        {
+            throw std::runtime_error("cannot open video " + m_filePath);
+        }
+        jumpToFrame(m_frameIndices.front());
+
+        vidStab.stabilizeTilesUsingMorphing(m_refFrame, *m_frameSource, m_frameIndices, m_keypoints, m_bestFeatures, tiles, margin, tileSums);
+
+        closeVideo();
+
+        // Average finished tiles and write them to the output file
+        int bandHeight = tiles[0].height;
+        cv::Mat bandAlpha;
+        AlphaBand band;
+        band.y = y;
+        band.tiles = tiles;
+        if (m_params.alphaMask)
+        {
+            bandAlpha.create(bandHeight, frameSize.width, CV_32FC1);
+        }
+
+        for (int t = 0; t < tiles.size(); ++t)
+        {
+            cv::Mat avgTile, tile8u;
+            tileSums[t].blend(avgTile);
+            avgTile.convertTo(tile8u, CV_8UC3);
+            tileWriter.writeTile(tile8u, tiles[t].tl());
+
+            if (!mappedAvgFrame.empty())
+            {
+                cv::Mat meanTile;
+                tileSums[t].average(meanTile);
+                meanTile.copyTo(mappedAvgFrame(tiles[t]));
+            }
+
+            if (m_params.alphaMask)
+            {
+                cv::Mat rawAlphaTile;
+                tileSums[t].alphaMask(rawAlphaTile, m_params.alphaSigma, m_params.alphaDisplacement);
+                rawAlphaTile.copyTo(bandAlpha(tiles[t] - cv::Point(0, y)));
+                band.avgTiles.push_back(avgTile);
+            }
+        }
+
+        if (m_params.alphaMask)
+        {
+            alphaRows.push_back(bandAlpha);
+            pendingBands.push_back(band);
+
+            // Blur and composite the bands whose rows below are rendered, all of them after the last band
+            int rowsDone = y + bandHeight;
+            while (!pendingBands.empty() && (pendingBands.front().y + tileSize + kAlphaBlurApron <= rowsDone || rowsDone == frameSize.height))
+            {
+                const AlphaBand& done = pendingBands.front();
+                int doneHeight = done.tiles[0].height;
+                int top = std::max(alphaTop, done.y - kAlphaBlurApron);
+                int bottom = std::min(rowsDone, done.y + doneHeight + kAlphaBlurApron);
+
+                // Beyond the rows of the window the blur only reaches out of the frame
+                cv::Mat blurred;
+                blurAlphaMask(alphaRows.rowRange(top - alphaTop, bottom - alphaTop).clone(), blurred);
+
+                for (int t = 0; t < done.tiles.size(); ++t)
+                {
+                    const cv::Rect& tile = done.tiles[t];
+                    cv::Mat alphaTile = blurred(cv::Rect(tile.x, done.y - top, tile.width, tile.height));
+                    cv::Mat alphaTile8u, compositeTile, tile8u;
+                    cv::Mat alphaChannels[] = { alphaTile, alphaTile, alphaTile };
+                    cv::merge(alphaChannels, 3, alphaTile8u);
+                    alphaTile8u.convertTo(alphaTile8u, CV_8UC3, 255.0);
+                    alphaWriter->writeTile(alphaTile8u, tile.tl());
+
+                    motionBlur(done.avgTiles[t], m_refFrame.getFrameData()(tile), alphaTile, compositeTile);
+                    compositeTile.convertTo(tile8u, CV_8UC3);
+                    compositeWriter->writeTile(tile8u, tile.tl());
+                }
+                pendingBands.erase(pendingBands.begin());
+
+                // Keep the raw rows the remaining bands still blur over
+                int newTop = pendingBands.empty() ? rowsDone : std::max(alphaTop, pendingBands.front().y - kAlphaBlurApron);
+                alphaRows = alphaRows.rowRange(newTop - alphaTop, rowsDone - alphaTop).clone();
+                alphaTop = newTop;
+            }
+        }
+
+        std::cout << "tile band " << y / tileSize + 1 << " of " << (frameSize.height + tileSize - 1) / tileSize << " done..." << std::endl;
+    }
+
+    tileWriter.close();
+    if (m_params.alphaMask)
+    {
+        alphaWriter->close();
+        compositeWriter->close();
+    }
+    if (mappedAvg.isOpen())
+    {
+        mappedAvg.close();
+        std::cout << mappedAvgPath << " (" << frameSize.width << "x" << frameSize.height << " BGR float) holds the average" << std::endl;
+    }
+
+    std::cout << "tiled stabilization and averaging done..." << std::endl;
+
+}
+
+
+// File name suffix of the blended image, "_avg" for the mean
+std::string VideoProcessing::blendSuffix() const
 {
+    return m_params.blendMode == "mean" ? "_avg" : "_" + m_params.blendMode;
+}
 
-    // Divide by number of frames
-    m_avgFrame *= (1.0/((m_numFrames + 1)));
 
-    std::cout << "averaging done..." << std::endl;
+// Path of the written blended image, PPM when rendered in tiles
+std::string VideoProcessing::blendedImagePath() const
+{
+    return m_params.outputDir + m_fileName + blendSuffix() + (m_params.tileSize > 0 ? ".ppm" : ".jpg");
+}
 
-    Drawing::saveImg(m_avgFrame, m_fileName + "_avg");
 
+// Wall clock seconds of the finished pipeline stages, in pipeline order
+const std::vector<std::pair<std::string, double> >& VideoProcessing::stageSeconds() const
+{
+    return m_stageSeconds;
+}
+
+
+// Record the wall clock time of a finished stage
+void VideoProcessing::stageDone(const std::string& stage, const std::chrono::steady_clock::time_point& start)
+{
+    m_stageSeconds.push_back(std::make_pair(stage, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()));
+}
+
+
+// Alpha mask of motion, computed from the per pixel luminance variance and mean lookup displacement
+// the accumulator gathered while summing up the aligned frames, no second pass over the frames
+// The mask is smoothed to hide the seams between sharp and long exposed regions
+void VideoProcessing::createAlphaMask(const FrameAccumulator& accumulator, cv::Mat& alphaMask)
+{
+    accumulator.alphaMask(alphaMask, m_params.alphaSigma, m_params.alphaDisplacement);
+    blurAlphaMask(alphaMask, alphaMask);
+}
+
+
+// Blur the raw alpha mask, the same kernel for whole frames and tiled bands
+void VideoProcessing::blurAlphaMask(const cv::Mat& rawMask, cv::Mat& alphaMask)
+{
+    int ksize = 2 * kAlphaBlurApron + 1;
+    cv::GaussianBlur(rawMask, alphaMask, cv::Size(ksize, ksize), kAlphaBlurSigma);
+}
+
+
+// Motion blur: composite = alpha * averaged frame + (1 - alpha) * reference frame
+// Moving regions show the long exposure, the static background stays as sharp as the reference frame
+void VideoProcessing::motionBlur(const cv::Mat& avgFrame, const cv::Mat& refFrameData, const cv::Mat& alphaMask, cv::Mat& composite)
+{
+    // Reference frame in 8-bit units
+    cv::Mat ref32f;
+    refFrameData.convertTo(ref32f, CV_32FC3, refFrameData.depth() == CV_16U ? 1.0 / 256 : 1.0);
+
+    composite.create(avgFrame.size(), CV_32FC3);
+    for (int i = 0; i < composite.rows; ++i)
+    {
+        const cv::Vec3f* avg = avgFrame.ptr<cv::Vec3f>(i);
+        const cv::Vec3f* ref = ref32f.ptr<cv::Vec3f>(i);
+        const float* alpha = alphaMask.ptr<float>(i);
+        cv::Vec3f* dst = composite.ptr<cv::Vec3f>(i);
+
+        for (int j = 0; j < composite.cols; ++j)
+        {
+            dst[j] = alpha[j] * avg[j] + (1.0f - alpha[j]) * ref[j];
+        }
+    }
 }
 
 
 // Open the video stream
 bool VideoProcessing::openVideo(const std::string& filePath) {
     std::cout << "::openVideo file: " << filePath << std::endl;
-    if (!m_videoCapture.open(filePath)) {
+    m_frameSource = FrameSource::open(filePath, m_params, m_pool, m_crop);
+    if (!m_frameSource) {
         std::cout << "Cannot open the video" << std::endl;
         return false;
     } else {
-        int frameCount = m_videoCapture.get(cv::CAP_PROP_FRAME_COUNT);
+        int frameCount = m_frameSource->frameCount();
         std::cout << "Video " << m_fileName << " successfully opened. " << frameCount << " frames loadable." << std::endl;
         return true;
     }
@@ -164,18 +750,20 @@ bool VideoProcessing::openVideo(const std::string& filePath) {
 // Close the video stream
 void VideoProcessing::closeVideo()
 {
-    m_videoCapture.release();
+    if (m_frameSource)
+    {
+        m_frameSource->printStats();
+    }
+    m_frameSource.reset();
 }
 
 
 // Jump to a certain frame number
 bool VideoProcessing::jumpToFrame(int pos) {
-    for (int idx = 0; idx < pos; ++idx) {
-        m_videoCapture.grab();
-    }
+    bool success = m_frameSource->seek(pos);
 
-    std::cout << "jumped to " << m_videoCapture.get(cv::CAP_PROP_POS_FRAMES) << std::endl;
-    return true;
+    std::cout << "jumped to " << m_frameSource->position() << std::endl;
+    return success;
 }
 
 
@@ -3,36 +3,96 @@
  *
  * ******************************/
 
+#ifndef VIDEOSTAB_VIDEOPROCESSING_HPP
+#define VIDEOSTAB_VIDEOPROCESSING_HPP
+
 // C++ std libraries
+#include <chrono>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 // User libraries
 #include "VideoFrame.hpp"
 #include "FeatureTracking.hpp"
 #include "VideoStabilizing.hpp"
+#include "FrameAccumulator.hpp"
+#include "FrameSource.hpp"
 #include "FeatureTrackingParams.hpp"
+#include "VideoProcessingParams.hpp"
+#include "ThreadPool.hpp"
 
+// Processing session: configured once, then any number of clips are processed in turn
+// Every clip runs through open, track, stabilize, blend and export (or process for all of them)
+// The worker pool, the sum of aligned frames and the output buffers are kept between clips,
+// their memory is reused while the frame size stays (a memory mapped sum gets a new file per clip)
 class VideoProcessing {
 public:
-    // Constructor
-    VideoProcessing(const std::string&, const std::string&);
+    // Constructor configures the session, no clip is processed yet
+    // All stages run on the given pool, without one the session starts its own pool
+    VideoProcessing(const VideoProcessingParams& = VideoProcessingParams(), ThreadPool* = 0);
+
+    // Change the settings for the following clips, an own worker pool is only restarted if its size changed
+    void configure(const VideoProcessingParams&);
+
+    // Process a clip: open, track, stabilize, blend and export
+    void process(const std::string&, const std::string&);
+
+    // Open a clip (file path, output name), the results of the previous clip are dropped
+    void open(const std::string&, const std::string&);
+
+    // Track features forward and backward from the reference frame
+    void track();
+
+    // Align the window frames to the reference frame, tiled rendering also blends and writes the tiles
+    void stabilize();
+
+    // Blend the aligned frames and create alpha mask and composite
+    void blend();
+
+    // Write blended image, alpha mask and composite
+    void exportResults();
+
+    // Blended image of the last clip in 8-bit units, empty when rendered in tiles
+    const cv::Mat& blendedImage() const;
+
+    // Path of the written blended image
+    std::string blendedImagePath() const;
+
+    // Wall clock seconds of the finished pipeline stages: tracking, then stabilizing, blending and export, or tiled
+    const std::vector<std::pair<std::string, double> >& stageSeconds() const;
 
 private:
+    // Progress of the current clip
+    enum Stage { kClosed, kOpened, kTracked, kStabilized, kBlended, kExported };
+
+    // Throw if the current clip has not reached the given stage
+    void requireStage(Stage, const std::string&) const;
+
     // Find feature motion
     void findFeatureMotion();
 
     // Stabilize frame based on knowledge of feature motion
-    void stabilizeFrames(cv::Mat&);
+    void stabilizeFrames(FrameAccumulator&);
 
-    // Average frames
-    void averagingFrames();
+    // Stabilize and average frames tile by tile, tiles are written to disk when finished
+    void stabilizeFramesTiled();
 
-    // Create alpha mask of motion
-    void createAlphaMask(int, int);
+    // File name suffix of the blended image
+    std::string blendSuffix() const;
 
-    // Motion blur
-    void motionBlur(int, int, const cv::Point2f);
+    // Record the wall clock time of a finished stage started at the given time
+    void stageDone(const std::string&, const std::chrono::steady_clock::time_point&);
+
+    // Create alpha mask of motion from the statistics of the accumulated frames
+    void createAlphaMask(const FrameAccumulator&, cv::Mat&);
+
+    // Blur a raw alpha mask (CV_32FC1) with the Gaussian of radius kAlphaBlurApron, in place if both are the same
+    static void blurAlphaMask(const cv::Mat&, cv::Mat&);
+
+    // Motion blur: blend the averaged frame over the reference frame where the alpha mask shows motion
+    void motionBlur(const cv::Mat&, const cv::Mat&, const cv::Mat&, cv::Mat&);
 
     // Open video stream
     bool openVideo(const std::string&);
@@ -44,17 +104,32 @@ private:
     bool jumpToFrame(int);
 
 private:
+    // Processing parameters
+    VideoProcessingParams m_params;
+
+    // Progress of the current clip
+    Stage m_stage;
+
+    // Workers decoding, detecting and aligning frames, shared by all clips
+    ThreadPool* m_pool;
+
+    // Own pool, null if the pool is shared with other sessions
+    std::unique_ptr<ThreadPool> m_ownPool;
+
     // File path
     std::string m_filePath;
 
     // File name
     std::string m_fileName;
 
-    // Video capture
-    cv::VideoCapture m_videoCapture;
+    // Frame source of the opened video
+    std::unique_ptr<FrameSource> m_frameSource;
 
-    // Frame index of starting frame
-    int m_startFrame;
+    // Rectangle of the frames that is processed, empty for full frames
+    cv::Rect m_crop;
+
+    // Frame index of the reference frame
+    int m_refIndex;
 
     // Number of frames to be processed
     int m_numFrames;
@@ -65,15 +140,29 @@ private:
     // Keypoints of all frames
     std::vector<std::vector<cv::Point2f> > m_keypoints;
 
+    // Frame indices of the window frames, in frame order, matching m_keypoints
+    std::vector<int> m_frameIndices;
+
     // Best feature indices
     std::vector<int> m_bestFeatures;
 
     // Feature tracking algorithm to track features and stabilize frames
     FeatureTracking m_featureTracking;
 
+    // Sum of aligned frames
+    FrameAccumulator m_accumulator;
+
     // Averaged frames
     cv::Mat m_avgFrame;
 
-    // Alpha masks
-    std::vector<cv::Mat> m_alphaMasks;
+    // Alpha mask of motion
+    cv::Mat m_alphaMask;
+
+    // Averaged frame over the reference frame where the alpha mask shows motion
+    cv::Mat m_composite;
+
+    // Wall clock seconds per pipeline stage
+    std::vector<std::pair<std::string, double> > m_stageSeconds;
 };
+
+#endif // VIDEOSTAB_VIDEOPROCESSING_HPP
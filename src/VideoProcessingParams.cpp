@@ -0,0 +1,214 @@
+/* ***********************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: VideoProcessingParams.cpp
+ * **********************************/
+
+// C++ std libraries
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+
+// User libraries
+#include "VideoProcessingParams.hpp"
+#include "WeightKernels.hpp"
+#include "FrameAccumulator.hpp"
+
+// Parse a single option of the form "key=value", leading dashes are ignored
+// @return: false if the option is unknown or malformed
+bool parseVideoProcessingParam(const std::string& option, VideoProcessingParams& params)
+{
+    std::string::size_type keyStart = option.find_first_not_of('-');
+    std::string::size_type sep = option.find('=');
+    if (keyStart == std::string::npos || sep == std::string::npos || sep <= keyStart)
+    {
+        std::cout << "malformed option: " << option << std::endl;
+        return false;
+    }
+
+    std::string key = option.substr(keyStart, sep - keyStart);
+    std::string value = option.substr(sep + 1);
+
+    if (key == "frames")
+    {
+        params.numFrames = std::atoi(value.c_str());
+    }
+    else if (key == "tile")
+    {
+        params.tileSize = std::atoi(value.c_str());
+    }
+    else if (key == "out")
+    {
+        params.outputDir = value;
+        if (params.outputDir.empty() || params.outputDir[params.outputDir.size() - 1] != '/')
+        {
+            params.outputDir += '/';
+        }
+    }
+    else if (key == "decode_ahead")
+    {
+        params.decodeAhead = std::atoi(value.c_str());
+    }
+    else if (key == "raw_width")
+    {
+        params.rawWidth = std::atoi(value.c_str());
+    }
+    else if (key == "raw_height")
+    {
+        params.rawHeight = std::atoi(value.c_str());
+    }
+    else if (key == "raw_format")
+    {
+        params.rawFormat = value;
+    }
+    else if (key == "motion_model")
+    {
+        if (value != "none" && value != "similarity" && value != "affine" && value != "homography")
+        {
+            std::cout << "unknown motion model: " << value << std::endl;
+            return false;
+        }
+        params.motionModel = value;
+    }
+    else if (key == "motion_max_residual")
+    {
+        params.motionMaxResidual = std::atof(value.c_str());
+    }
+    else if (key == "motion_min_inliers")
+    {
+        params.motionMinInliers = std::atof(value.c_str());
+    }
+    else if (key == "alpha_mask")
+    {
+        params.alphaMask = std::atoi(value.c_str()) != 0;
+    }
+    else if (key == "alpha_sigma")
+    {
+        params.alphaSigma = std::atof(value.c_str());
+    }
+    else if (key == "alpha_displacement")
+    {
+        params.alphaDisplacement = std::atof(value.c_str());
+    }
+    else if (key == "weight_kernel")
+    {
+        if (!isWeightKernel(value))
+        {
+            std::cout << "unknown weight kernel: " << value << std::endl;
+            return false;
+        }
+        params.weightKernel = value;
+    }
+    else if (key == "warp_threads")
+    {
+        params.warpThreads = std::atoi(value.c_str());
+    }
+    else if (key == "blend")
+    {
+        if (!FrameAccumulator::isBlendMode(value))
+        {
+            std::cout << "unknown blend mode: " << value << std::endl;
+            return false;
+        }
+        params.blendMode = value;
+    }
+    else if (key == "trim")
+    {
+        params.trimFraction = std::atof(value.c_str());
+    }
+    else if (key == "memory_stats")
+    {
+        params.memoryStats = std::atoi(value.c_str()) != 0;
+    }
+    else if (key == "crop")
+    {
+        if (value == "auto")
+        {
+            params.cropAuto = true;
+        }
+        else if (std::sscanf(value.c_str(), "%d,%d,%d,%d", &params.cropX, &params.cropY, &params.cropWidth, &params.cropHeight) != 4 || params.cropWidth <= 0 || params.cropHeight <= 0)
+        {
+            std::cout << "crop needs auto or x,y,width,height: " << value << std::endl;
+            return false;
+        }
+    }
+    else if (key == "crop_margin")
+    {
+        params.cropMargin = std::atoi(value.c_str());
+    }
+    else if (key == "static_threshold")
+    {
+        params.staticThreshold = std::atof(value.c_str());
+    }
+    else if (key == "hdr")
+    {
+        if (value != "none" && value != "png" && value != "tiff" && value != "float")
+        {
+            std::cout << "unknown hdr format: " << value << std::endl;
+            return false;
+        }
+        params.hdrFormat = value;
+    }
+    else if (key == "mapped_accumulator")
+    {
+        params.mappedAccumulator = std::atoi(value.c_str()) != 0;
+    }
+    else if (key == "export_video")
+    {
+        params.exportVideo = std::atoi(value.c_str()) != 0;
+    }
+    else if (key == "export_codec")
+    {
+        if (value.size() != 4)
+        {
+            std::cout << "codec must be a four character code: " << value << std::endl;
+            return false;
+        }
+        params.exportCodec = value;
+    }
+    else if (key == "export_fps")
+    {
+        params.exportFps = std::atof(value.c_str());
+    }
+    else if (key == "export_queue")
+    {
+        params.exportQueue = std::atoi(value.c_str());
+    }
+    else if (key == "converge")
+    {
+        params.convergeThreshold = std::atof(value.c_str());
+    }
+    else if (key == "converge_frames")
+    {
+        params.convergeFrames = std::atoi(value.c_str());
+    }
+    else if (key == "sub_frames")
+    {
+        params.subFrames = std::atoi(value.c_str());
+    }
+    else if (key == "control_points")
+    {
+        params.controlPoints = std::atoi(value.c_str());
+    }
+    else if (key == "control_point_motion")
+    {
+        params.controlPointMotion = std::atof(value.c_str());
+    }
+    else if (key == "debug_frames")
+    {
+        params.debugFrames = std::atoi(value.c_str()) != 0;
+    }
+    else if (key == "compact")
+    {
+        params.compact = std::atoi(value.c_str()) != 0;
+    }
+    else
+    {
+        std::cout << "unknown option: " << key << std::endl;
+        return false;
+    }
+
+    return true;
+}
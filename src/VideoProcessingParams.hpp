@@ -0,0 +1,60 @@
+/* ***********************************
+ * Author: Andrin Jenal
+ * Supervisor: Marcel Lancelle
+ * Department: ETH Zürich
+ * Copyright: 2013 ETH Zürich
+ * File: VideoProcessingParams.hpp
+ * **********************************/
+
+#ifndef VIDEOSTAB_VIDEOPROCESSING_PARAMS_HPP
+#define VIDEOSTAB_VIDEOPROCESSING_PARAMS_HPP
+
+#include <string>
+
+struct VideoProcessingParams {
+    VideoProcessingParams() : numFrames(30), tileSize(0), compact(false), outputDir("/tmp/vidstab/images/"), decodeAhead(0), rawWidth(0), rawHeight(0), rawFormat("bgr24"), motionModel("none"), motionMaxResidual(0.5), motionMinInliers(0.9), alphaMask(false), alphaSigma(10.0), alphaDisplacement(4.0), debugFrames(true), weightKernel("powexp"), warpThreads(0), blendMode("mean"), trimFraction(0.1), memoryStats(false), cropAuto(false), cropX(0), cropY(0), cropWidth(0), cropHeight(0), cropMargin(32), staticThreshold(0.1), hdrFormat("none"), mappedAccumulator(false), exportVideo(false), exportCodec("MJPG"), exportFps(0.0), exportQueue(8), convergeThreshold(0.0), convergeFrames(8), subFrames(0), controlPoints(0), controlPointMotion(1.0) {}
+
+    int numFrames; // number of frames averaged onto the reference frame
+    int tileSize; // edge length of a render tile in pixels, 0: render the whole frame at once
+    bool compact; // sample 8/16-bit sources directly, align to 16-bit fixed point and accumulate in 32-bit integers
+    std::string outputDir; // directory of all written images, debug images go to its "raw/" subdirectory
+    int decodeAhead; // number of frames decoded ahead on a dedicated thread, 0: decode inline
+    int rawWidth; // frame width of headerless raw input files
+    int rawHeight; // frame height of headerless raw input files
+    std::string rawFormat; // pixel format of raw input files: bgr24, rgb24, gray8, i420, bgr48
+    std::string motionModel; // global motion fast path: none, similarity, affine or homography
+    double motionMaxResidual; // max RMS reprojection error (pixels) of the global model to skip the morph
+    double motionMinInliers; // min RANSAC inlier ratio of the global model to skip the morph
+    bool alphaMask; // composite the long exposure of moving regions over the sharp reference frame
+    double alphaSigma; // temporal luminance standard deviation (8-bit units) that counts as full motion
+    double alphaDisplacement; // mean lookup displacement (pixels) that counts as full motion
+    bool debugFrames; // write feature vectors, aligned and original frame of every frame to "raw/", off: warp straight into the sum
+    std::string weightKernel; // weight kernel of the morph: powexp, gaussian, idw or wendland
+    int warpThreads; // threads aligning frames in parallel, 0: one per hardware thread
+    std::string blendMode; // per pixel blend of the aligned frames: mean, median, trimmed, max or min
+    double trimFraction; // fraction of the samples the trimmed mean drops at each end
+    bool memoryStats; // count cv::Mat allocations and sample the resident set size per pipeline stage, summary at exit
+    bool cropAuto; // crop to the range of the best features of the initial tracking plus cropMargin
+    int cropX; // left edge of the user crop rectangle
+    int cropY; // top edge of the user crop rectangle
+    int cropWidth; // width of the user crop rectangle, 0: no user crop
+    int cropHeight; // height of the user crop rectangle
+    int cropMargin; // margin (pixels) around the best feature range of the automatic crop
+    double staticThreshold; // max deviation (pixels) of all feature displacements from one integer shift to copy the frame instead of warping it, 0: off
+    std::string hdrFormat; // additional output of the blended image without 8-bit clipping: none, png, tiff (16-bit) or float (raw)
+    bool mappedAccumulator; // keep the floating point sum in a memory mapped file "<name>_avg.f32" that ends up holding the average
+    bool exportVideo; // encode the aligned frames and the reference frame as the stabilized clip "<name>_stabilized.avi"
+    std::string exportCodec; // four character code of the stabilized clip
+    double exportFps; // frames per second of the stabilized clip, 0: the rate of the input (30 if unknown)
+    int exportQueue; // aligned frames waiting for the encoder before the aligning workers block
+    double convergeThreshold; // stop aligning once the running average changes less than this (mean absolute, 8-bit units) per frame, 0: off
+    int convergeFrames; // number of consecutive frames below convergeThreshold to stop
+    int subFrames; // frames synthesized between consecutive aligned window frames by interpolating the residual motion of the tracks that are no best features
+    int controlPoints; // max number of control points the best features are merged into for the morph, 0: off
+    double controlPointMotion; // max distance (pixels) of a merged track from the mean track of its control point in any window frame
+};
+
+// Parse a single "key=value" (or "--key=value") option into the params
+bool parseVideoProcessingParam(const std::string&, VideoProcessingParams&);
+
+#endif // VIDEOSTAB_VIDEOPROCESSING_PARAMS_HPP
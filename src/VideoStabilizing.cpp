@@ -9,59 +9,861 @@
 // C++ std libraries
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// OpenCV libraries
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 // User libraries
 #include "VideoStabilizing.hpp"
 #include "Drawing.hpp"
+#include "ReductionTree.hpp"
+#include "ThreadPool.hpp"
+#include "ConvergenceMonitor.hpp"
+
+namespace
+{
+    // Downsampling factor of the sums compared by the convergence monitor
+    const int kPreviewFactor = 8;
+
+    // Blocks aligned at a time into a memory mapped sum, each one holds a full size block sum on the heap
+    const int kMappedWaveBlocks = 4;
+
+    // Radius around a moving track its residual motion is spread over, relative to the larger frame dimension
+    const float kResidualRadius = 0.03f;
+
+    // Residual steps of a track between two window frames in pixels: shorter ones are static, longer ones
+    // (relative to the larger frame dimension) are lost tracks
+    const float kMinResidualStep = 1.0f;
+    const float kMaxResidualStep = 0.05f;
+
+    // Residual motion between two aligned window frames, in reference frame coordinates
+    // Both frames are mapped to the reference frame by homographies fitted to the best features, the tracks that are
+    // no best features and whose aligned position changes are moving content. Their steps are spread over the pixels
+    // around them with a Gaussian falloff, the morph kernels would spread them over the static background as well.
+    // @return: false if no track moves, flow is left empty then
+    bool residualFlow(const std::vector<cv::Point2f>& refFrameKeypts, const std::vector<cv::Point2f>& keypoints, const std::vector<cv::Point2f>& nextKeypoints, const std::vector<int>& bestFeatures, const cv::Size& frameSize, cv::Mat& flow)
+    {
+        if (bestFeatures.size() < 4 || keypoints.empty() || keypoints.size() != nextKeypoints.size())
+        {
+            return false;
+        }
+
+        std::vector<cv::Point2f> refPts, pts, nextPts;
+        std::vector<bool> isBest(keypoints.size(), false);
+        for (int i = 0; i < bestFeatures.size(); ++i)
+        {
+            refPts.push_back(refFrameKeypts[bestFeatures[i]]);
+            pts.push_back(keypoints[bestFeatures[i]]);
+            nextPts.push_back(nextKeypoints[bestFeatures[i]]);
+            isBest[bestFeatures[i]] = true;
+        }
+
+        cv::Mat toRef = cv::findHomography(pts, refPts, cv::RANSAC, 2.0);
+        cv::Mat nextToRef = cv::findHomography(nextPts, refPts, cv::RANSAC, 2.0);
+        if (toRef.empty() || nextToRef.empty())
+        {
+            return false;
+        }
+
+        // Aligned positions of all tracks in both frames
+        std::vector<cv::Point2f> aligned, nextAligned;
+        cv::perspectiveTransform(keypoints, aligned, toRef);
+        cv::perspectiveTransform(nextKeypoints, nextAligned, nextToRef);
+
+        float maxDim = std::max(frameSize.width, frameSize.height);
+        float radius = kResidualRadius * maxDim;
+        float maxStep = kMaxResidualStep * maxDim;
+        float invTwoSigmaSq = 2.0f / (radius * radius);
+
+        // Weighted steps and weights of the moving tracks, sigma is half the radius
+        cv::Mat stepSum = cv::Mat::zeros(frameSize, CV_32FC2);
+        cv::Mat weightSum = cv::Mat::zeros(frameSize, CV_32FC1);
+        int numMoving = 0;
+        for (int i = 0; i < keypoints.size(); ++i)
+        {
+            cv::Point2f p = aligned[i];
+            cv::Point2f step = nextAligned[i] - p;
+            float len = std::sqrt(step.x * step.x + step.y * step.y);
+            bool inside = p.x >= 0 && p.y >= 0 && p.x < frameSize.width && p.y < frameSize.height;
+            if (isBest[i] || !inside || !(len > kMinResidualStep && len <= maxStep))
+            {
+                continue;
+            }
+            ++numMoving;
+
+            int x0 = std::max(0, (int) std::floor(p.x - radius));
+            int x1 = std::min(frameSize.width - 1, (int) std::ceil(p.x + radius));
+            int y0 = std::max(0, (int) std::floor(p.y - radius));
+            int y1 = std::min(frameSize.height - 1, (int) std::ceil(p.y + radius));
+            for (int y = y0; y <= y1; ++y)
+            {
+                cv::Point2f* ss = stepSum.ptr<cv::Point2f>(y);
+                float* ws = weightSum.ptr<float>(y);
+                for (int x = x0; x <= x1; ++x)
+                {
+                    float d2 = (x - p.x) * (x - p.x) + (y - p.y) * (y - p.y);
+                    if (d2 <= radius * radius)
+                    {
+                        float w = std::exp(-d2 * invTwoSigmaSq);
+                        ss[x] += w * step;
+                        ws[x] += w;
+                    }
+                }
+            }
+        }
+        if (numMoving == 0)
+        {
+            return false;
+        }
+
+        // Overlapping tracks are averaged, a single track fades out towards its radius
+        flow.create(frameSize, CV_32FC2);
+        for (int y = 0; y < frameSize.height; ++y)
+        {
+            const cv::Point2f* ss = stepSum.ptr<cv::Point2f>(y);
+            const float* ws = weightSum.ptr<float>(y);
+            cv::Point2f* dst = flow.ptr<cv::Point2f>(y);
+            for (int x = 0; x < frameSize.width; ++x)
+            {
+                dst[x] = ss[x] * (1.0f / std::max(ws[x], 1.0f));
+            }
+        }
+        return true;
+    }
+
+    // Add a finished block sum to the reduction tree, or straight to a memory mapped sum, and release it
+    // Mapped sums get their blocks in block order, so the result does not depend on the number of workers either
+    void commitBlock(int block, FrameAccumulator& blockSum, bool mapped, ReductionTree& tree, FrameAccumulator& accumulator)
+    {
+        if (mapped)
+        {
+            accumulator.merge(blockSum);
+            blockSum = FrameAccumulator();
+        }
+        else
+        {
+            tree.insert(block, blockSum);
+        }
+    }
+}
 
 // Construct a video warper that processes "frames"
-VideoStabilizing::VideoStabilizing()
+VideoStabilizing::VideoStabilizing(const VideoProcessingParams& params, ThreadPool* pool) : m_params(params), m_numShiftedFrames(0), m_numGlobalMotionFrames(0), m_numMorphedFrames(0), m_pool(pool), m_exporter(0), m_refPosition(0)
+{
+}
+
+
+// Hand the aligned frames to the exporter
+void VideoStabilizing::setExporter(VideoExporter* exporter, int refPosition)
 {
-    // Empty constructor
+    m_exporter = exporter;
+    m_refPosition = refPosition;
+}
+
+
+// Pool aligning the frames
+ThreadPool& VideoStabilizing::workerPool()
+{
+    if (m_pool)
+    {
+        return *m_pool;
+    }
+    if (!m_ownPool)
+    {
+        m_ownPool.reset(new ThreadPool(m_params.warpThreads));
+    }
+    return *m_ownPool;
 }
 
 
 // stabilizeUsingHomography is a feature based morphing alorithm, that stabilizes frames using weighted motion vectors of the moving features
-void VideoStabilizing::stabilizeUsingMorphing(VideoFrame& refFrame, cv::VideoCapture& vidCapt, int numFrames, std::vector<std::vector<cv::Point2f> >& keypoints, std::vector<int>& bestFeatures, cv::Mat& avgFrame)
+// Frames are decoded in order and aligned in parallel, blocks of consecutive frames are summed up by one worker each
+// and the block sums are combined by a reduction tree (added in block order to a mapped sum), so the result does not depend on the number of workers
+void VideoStabilizing::stabilizeUsingMorphing(VideoFrame& refFrame, FrameSource& frameSource, const std::vector<int>& frameIndices, std::vector<std::vector<cv::Point2f> >& keypoints, std::vector<int>& bestFeatures, FrameAccumulator& accumulator)
 {
-    
-    // Temporary placeholder
-    VideoFrame nextFrame;
 
-    std::cout << "start stabilization with frame " << (vidCapt.get(cv::CAP_PROP_POS_FRAMES) + 1) << std::endl;
-   
+    // Frames per block, i.e. per leaf of the reduction tree
+    // Convergence is checked once a block is aligned, single frame blocks align at most one frame per worker past the converged frame
+    const int blockFrames = m_params.convergeThreshold > 0.0 ? 1 : 4;
+
+    resetPathStats();
+    prepareWeightKernel(refFrame.getFrameSize());
+
+    int numFrames = keypoints.size();
+    int numBlocks = (numFrames + blockFrames - 1) / blockFrames;
+
+    ReductionTree tree(numBlocks);
+    std::vector<AlignmentPath> paths(numFrames, kMorphPath);
+
+    ThreadPool& pool = workerPool();
+
+    std::cout << "start stabilization with frame " << frameIndices.front() << " on " << pool.numThreads() << " threads" << std::endl;
+
+    // The reference frame is handed over right after the window frame before it, so it never waits for a frame behind it
+    cv::Mat ref8u;
+    if (m_exporter)
+    {
+        refFrame.getFrameData().convertTo(ref8u, CV_8UC3, refFrame.getFrameData().depth() == CV_8U ? 1.0 : 1.0 / 256);
+        if (m_refPosition == 0)
+        {
+            m_exporter->write(0, ref8u);
+        }
+    }
+
+    // Convergence of the exposure is checked frame by frame on downsampled sums after every wave
+    // Block sums are then inserted in block order by this thread, blocks after the converged frame are dropped,
+    // so the result still does not depend on the number of workers
+    std::unique_ptr<ConvergenceMonitor> monitor;
+    std::vector<cv::Mat> previews;
+    std::vector<FrameAccumulator> waveSums;
+    cv::Mat blocksDone;
+    if (m_params.convergeThreshold > 0.0)
+    {
+        monitor.reset(new ConvergenceMonitor(m_params.convergeThreshold, m_params.convergeFrames));
+        accumulator.sumPreview(blocksDone, kPreviewFactor);
+        monitor->reset(blocksDone, accumulator.numFrames());
+        previews.resize(numFrames);
+    }
+
+    // A memory mapped sum takes the block sums in block order after every wave instead of the reduction tree,
+    // so besides the mapped sum at most kMappedWaveBlocks full size sums live on the heap
+    bool mapped = accumulator.isMapped();
+    int waveBlocks = mapped ? std::min(pool.numThreads(), kMappedWaveBlocks) : pool.numThreads();
+    if (monitor || mapped)
+    {
+        waveSums.resize(waveBlocks);
+    }
+    int numAligned = 0;
+    int numBlocksUsed = numBlocks;
+
+    // Window frame that could not be decoded, the blocks already submitted are finished before the error is thrown
+    int unreadIndex = -1;
+
+    // Blocks are processed in waves of one block per worker, this bounds the number of decoded frames in memory
+    for (int wave = 0; wave < numBlocks && numBlocksUsed == numBlocks; wave += waveBlocks)
+    {
+        TaskGroup blocks;
+        for (int b = wave; b < std::min(numBlocks, wave + waveBlocks); ++b)
+        {
+            // Decode the frames of the block in frame order
+            int blockBegin = b * blockFrames;
+            int numBlockFrames = std::min(numFrames, blockBegin + blockFrames) - blockBegin;
+            std::vector<cv::Mat> frames;
+            for (int k = blockBegin; k < blockBegin + numBlockFrames && unreadIndex < 0; ++k)
+            {
+                cv::Mat tmpFrame;
+                if (!readFrame(frameSource, frameIndices[k], tmpFrame) || tmpFrame.empty())
+                {
+                    unreadIndex = frameIndices[k];
+                }
+                frames.push_back(tmpFrame);
+            }
+            if (unreadIndex >= 0)
+            {
+                break;
+            }
+
+            pool.submit(blocks, [this, &refFrame, &frameIndices, &keypoints, &bestFeatures, &accumulator, &tree, &paths, &ref8u, &previews, &waveSums, wave, b, frames, blockBegin, numFrames]() mutable
+            {
+                FrameAccumulator blockSum;
+                blockSum.resetLike(accumulator);
+
+                for (int f = 0; f < frames.size(); ++f)
+                {
+                    int k = blockBegin + f;
+                    int numSub = numSubFrames(k, numFrames);
+
+                    // A frame with sub-frames is handed back aligned and added together with them
+                    cv::Mat aligned;
+                    AlignedFrame alignedFrame;
+                    paths[k] = alignAndAccumulate(refFrame, frames[f], frameIndices[k], keypoints[k], bestFeatures, blockSum, m_exporter ? &aligned : 0, numSub > 0 ? &alignedFrame : 0);
+                    if (numSub > 0)
+                    {
+                        accumulateWithSubFrames(refFrame, alignedFrame, keypoints[k], keypoints[k + 1], bestFeatures, numSub, blockSum);
+                    }
+
+                    // Window frames after the reference frame follow it in the clip
+                    if (m_exporter)
+                    {
+                        m_exporter->write(k < m_refPosition ? k : k + 1, aligned);
+                        if (k + 1 == m_refPosition)
+                        {
+                            m_exporter->write(m_refPosition, ref8u);
+                        }
+                    }
+
+                    if (!previews.empty())
+                    {
+                        blockSum.sumPreview(previews[k], kPreviewFactor);
+                    }
+                }
+
+                if (waveSums.empty())
+                {
+                    tree.insert(b, blockSum);
+                }
+                else
+                {
+                    std::swap(waveSums[b - wave], blockSum);
+                }
+            }, b);
+        }
+
+        pool.wait(blocks);
+        if (unreadIndex >= 0)
+        {
+            throw std::runtime_error("cannot read window frame " + std::to_string(unreadIndex));
+        }
+
+        int waveEnd = std::min(numBlocks, wave + waveBlocks);
+        numAligned = std::min(numFrames, waveEnd * blockFrames);
+
+        if (monitor)
+        {
+            for (int b = wave; b < waveEnd; ++b)
+            {
+                // Running sum after every frame of the block: finished blocks plus the block so far
+                int k = b * blockFrames;
+                for (; k < std::min(numFrames, (b + 1) * blockFrames) && !monitor->converged(); ++k)
+                {
+                    monitor->addFrames(blocksDone + previews[k], 1 + numSubFrames(k, numFrames));
+                }
+                blocksDone += previews[k - 1];
+                commitBlock(b, waveSums[b - wave], mapped, tree, accumulator);
+
+                if (monitor->converged())
+                {
+                    // The rest of the block is already in its sum
+                    std::cout << "exposure converged at frame " << frameIndices[k - 1] << " (change " << monitor->lastChange() << " below " << m_params.convergeThreshold << " for " << m_params.convergeFrames << " frames)" << std::endl;
+                    numBlocksUsed = b + 1;
+                    break;
+                }
+            }
+        }
+        else if (mapped)
+        {
+            for (int b = wave; b < waveEnd; ++b)
+            {
+                commitBlock(b, waveSums[b - wave], mapped, tree, accumulator);
+            }
+        }
+    }
+
+    // Sum up aligned frames to average it afterwards
+    if (numBlocks > 0 && !mapped)
+    {
+        accumulator.merge(numBlocksUsed == numBlocks ? tree.root() : tree.finish());
+    }
+
+    if (monitor)
+    {
+        int numUsed = std::min(numFrames, numBlocksUsed * blockFrames);
+        std::cout << "convergence: " << numUsed << " of " << numFrames << " frames used, " << numFrames - numAligned << " frames not decoded and aligned" << std::endl;
+    }
+
+    int numSynthesized = 0;
+    for (int k = 0; k < numAligned; ++k)
+    {
+        ++(paths[k] == kShiftPath ? m_numShiftedFrames : paths[k] == kGlobalMotionPath ? m_numGlobalMotionFrames : m_numMorphedFrames);
+        numSynthesized += numSubFrames(k, numFrames);
+    }
+    if (numSynthesized > 0)
+    {
+        std::cout << numSynthesized << " sub-frames synthesized between " << numAligned << " decoded frames" << std::endl;
+    }
+
+    printPathStats();
+    std::cout << "feature based morphing done..." << std::endl;
+
+}
+
+
+// Align a single frame to the reference frame (refFrame) and add it to the accumulator
+// A frame whose features all moved by the same integer shift (most often none) is copied,
+// nearly rigid motion is aligned by a single warp, everything else gets morphed
+// @return: the alignment path the frame took
+AlignmentPath VideoStabilizing::alignAndAccumulate(VideoFrame& refFrame, cv::Mat& frame, int frameIndex, std::vector<cv::Point2f>& keypoints, std::vector<int>& bestFeatures, FrameAccumulator& accumulator, cv::Mat* aligned8u, AlignedFrame* deferred) const
+{
+
+    VideoFrame nextFrame(frame, cv::Rect(0, 0, frame.cols, frame.rows), m_params.compact);
+    nextFrame.setWeightKernel(m_params.weightKernel, m_powerExpKernel.get());
+    nextFrame.setFeatureWeights(refFrame.getFeatureWeights());
+
+    std::ostringstream ostr;
+    ostr << m_params.outputDir << "raw/frame" << frameIndex;
+
+    cv::Point shift;
+    GlobalMotion motion;
+    AlignmentPath path = kMorphPath;
+    if (estimateShift(refFrame.getKeypoints(), keypoints, bestFeatures, shift))
+    {
+        path = kShiftPath;
+    }
+    else if (estimateGlobalMotion(refFrame.getKeypoints(), keypoints, bestFeatures, motion))
+    {
+        path = kGlobalMotionPath;
+    }
+    cv::Rect frameRect(cv::Point(0, 0), nextFrame.getFrameSize());
+
+    if (!m_params.debugFrames && !aligned8u && !deferred)
+    {
+        // Warp straight into the sum of aligned frames, the aligned frame is never stored
+        if (path == kShiftPath)
+        {
+            nextFrame.accumulateTileByShift(shift, frameRect, accumulator);
+        }
+        else if (path == kGlobalMotionPath)
+        {
+            nextFrame.accumulateTileByGlobalMotion(motion.homography, frameRect, accumulator);
+        }
+        else
+        {
+            nextFrame.accumulateTileByFeatureBasedMorphing(refFrame.getKeypoints(), keypoints, bestFeatures, frameRect, accumulator);
+        }
+    }
+    else
+    {
+        // Lookup displacements are only needed for the alpha mask
+        cv::Mat displacement;
+        cv::Mat* dispOut = accumulator.hasMotionStats() ? &displacement : 0;
+
+        if (path == kShiftPath)
+        {
+            nextFrame.alignTileByShift(shift, frameRect, dispOut);
+        }
+        else if (path == kGlobalMotionPath)
+        {
+            nextFrame.alignTileByGlobalMotion(motion.homography, frameRect, dispOut);
+        }
+        else
+        {
+            nextFrame.alignFrameByFeatureBasedMorphing(refFrame.getKeypoints(), keypoints, bestFeatures, dispOut);
+        }
+
+        if (m_params.debugFrames)
+        {
+            // FOR DEBUGGING PURPOSE ONLY
+            Drawing::saveFeatureVecs(refFrame, nextFrame, keypoints, bestFeatures, ostr.str());
+
+            // FOR ANALYSIS
+            ostr << "aligned";
+            if (m_params.compact)
+            {
+                cv::Mat debug8u;
+                nextFrame.getAlignedFrameData16u().convertTo(debug8u, CV_8UC3, 1.0 / 256);
+                Drawing::saveImg(debug8u, ostr.str());
+            }
+            else
+            {
+                Drawing::saveImg(nextFrame.getAlignedFrameData32f(), ostr.str());
+            }
+            ostr << "original";
+            Drawing::saveImg(nextFrame.getFrameData(), ostr.str());
+        }
+
+        if (aligned8u)
+        {
+            if (m_params.compact)
+            {
+                nextFrame.getAlignedFrameData16u().convertTo(*aligned8u, CV_8UC3, 1.0 / 256);
+            }
+            else
+            {
+                nextFrame.getAlignedFrameData32f().convertTo(*aligned8u, CV_8UC3);
+            }
+        }
+
+        if (deferred)
+        {
+            deferred->frame = nextFrame;
+            deferred->displacement = displacement;
+        }
+        else
+        {
+            accumulate(nextFrame, displacement, accumulator);
+        }
+    }
+
+    if (path == kShiftPath)
+    {
+        std::cout << "frame " << frameIndex << " succesfully aligned by shift (" << shift.x << ", " << shift.y << ")" << std::endl;
+    }
+    else if (path == kGlobalMotionPath)
+    {
+        std::cout << "frame " << frameIndex << " succesfully warped by global " << m_params.motionModel << " (residual " << motion.residual << " px)" << std::endl;
+    }
+    else
+    {
+        std::cout << "frame " << frameIndex << " succesfully warped by morphing" << std::endl;
+    }
+
+    return path;
+}
+
+
+// Add an aligned frame and its sub-frames towards the next window frame
+// Both window frames are aligned to the reference frame, so the background already matches: a sub-frame keeps the
+// alignment of the earlier frame and only moves it by the interpolated residual motion of the tracks that are no
+// best features (cars, water or clouds), linear in the sub-frame time. The aligned frame is released afterwards.
+void VideoStabilizing::accumulateWithSubFrames(VideoFrame& refFrame, AlignedFrame& alignedFrame, const std::vector<cv::Point2f>& keypoints, const std::vector<cv::Point2f>& nextKeypoints, const std::vector<int>& bestFeatures, int numSub, FrameAccumulator& accumulator) const
+{
+    accumulate(alignedFrame.frame, alignedFrame.displacement, accumulator);
+
+    // Without moving tracks every sub-frame is the aligned frame itself
+    cv::Mat flow;
+    if (!residualFlow(refFrame.getKeypoints(), keypoints, nextKeypoints, bestFeatures, alignedFrame.frame.getFrameSize(), flow))
+    {
+        for (int s = 1; s <= numSub; ++s)
+        {
+            accumulate(alignedFrame.frame, alignedFrame.displacement, accumulator);
+        }
+        alignedFrame = AlignedFrame();
+        return;
+    }
+
+    cv::Mat& samples = m_params.compact ? alignedFrame.frame.getAlignedFrameData16u() : alignedFrame.frame.getAlignedFrameData32f();
+    cv::Mat mapX(flow.size(), CV_32FC1);
+    cv::Mat mapY(flow.size(), CV_32FC1);
+    for (int s = 1; s <= numSub; ++s)
+    {
+        // Sub-frame s shows the earlier frame moved by s/(numSub+1) of the residual motion
+        float t = (float) s / (numSub + 1);
+        for (int i = 0; i < flow.rows; ++i)
+        {
+            const cv::Point2f* f = flow.ptr<cv::Point2f>(i);
+            float* mx = mapX.ptr<float>(i);
+            float* my = mapY.ptr<float>(i);
+            for (int j = 0; j < flow.cols; ++j)
+            {
+                mx[j] = j - t * f[j].x;
+                my[j] = i - t * f[j].y;
+            }
+        }
+
+        // Samples are weighted by their validity, both are resampled alike
+        cv::Mat subSamples, subValidity, subDisplacement;
+        cv::remap(samples, subSamples, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+        if (!alignedFrame.frame.getValidity().empty())
+        {
+            cv::remap(alignedFrame.frame.getValidity(), subValidity, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+        }
+        else
+        {
+            cv::remap(cv::Mat::ones(flow.size(), CV_32FC1), subValidity, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+        }
+        if (!alignedFrame.displacement.empty())
+        {
+            cv::remap(alignedFrame.displacement, subDisplacement, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+        }
+        accumulator.add(subSamples, subDisplacement, subValidity);
+    }
+
+    alignedFrame = AlignedFrame();
+}
+
+
+// Number of sub-frames after the window frame with the given index, the last window frame has none
+int VideoStabilizing::numSubFrames(int k, int numFrames) const
+{
+    return k + 1 < numFrames ? std::max(0, m_params.subFrames) : 0;
+}
+
+
+// Tiled feature based morphing
+// Every tile is warped from the source region it can sample from (tile plus margin) only
+// @tiles:    tiles in frame coordinates
+// @margin:   maximum displacement of a lookup in pixels
+// @tileSums: per tile sum of aligned frames
+void VideoStabilizing::stabilizeTilesUsingMorphing(VideoFrame& refFrame, FrameSource& frameSource, const std::vector<int>& frameIndices, std::vector<std::vector<cv::Point2f> >& keypoints, std::vector<int>& bestFeatures, const std::vector<cv::Rect>& tiles, int margin, std::vector<FrameAccumulator>& tileSums)
+{
+
+    // Tiles of a frame are aligned in parallel, every tile sum is only touched by one task per frame
+    // and sees the frames in frame order, so the result does not depend on the number of threads
+    ThreadPool& pool = workerPool();
+
+    // Every band of tiles is a pass over the same frames, the paths are counted per band
+    resetPathStats();
+    prepareWeightKernel(refFrame.getFrameSize());
+
     // Iterate over all frames keypoints
     for (std::vector<std::vector<cv::Point2f> >::iterator it = (keypoints.begin()); it != keypoints.end(); ++it)
     {
 
-        // Update current and next frame
         cv::Mat tmpFrame;
-        vidCapt.read(tmpFrame);
-        nextFrame = VideoFrame(tmpFrame);
-
-        //Drawing::showImg32f(nextFrame.getFrameData32f());
-        
-        std::ostringstream ostr;
-        ostr << "raw/frame" << vidCapt.get(cv::CAP_PROP_POS_FRAMES);
-
-        // For all frames align to reference frame (refFrame)
-        nextFrame.alignFrameByFeatureBasedMorphing(refFrame.getKeypoints(), *it, bestFeatures);
-        std::cout << "frame " << vidCapt.get(cv::CAP_PROP_POS_FRAMES) << " succesfully warped" << std::endl;
-   
-        // FOR DEBUGGING PURPOSE ONLY
-        Drawing::saveFeatureVecs(refFrame, nextFrame, *it, bestFeatures, ostr.str());
-
-        // FOR ANALYSIS
-        ostr << "aligned";
-        Drawing::saveImg(nextFrame.getAlignedFrameData32f(), ostr.str());
-        ostr << "original";
-        Drawing::saveImg(nextFrame.getFrameData32f(), ostr.str());
-      
-        // Sum up aligned frames to average it afterwards
-        avgFrame += nextFrame.getAlignedFrameData32f();
-        std::cout << "cummulated frame " << vidCapt.get(cv::CAP_PROP_POS_FRAMES) << std::endl;
+        int frameIndex = frameIndices[it - keypoints.begin()];
+        if (!readFrame(frameSource, frameIndex, tmpFrame) || tmpFrame.empty())
+        {
+            throw std::runtime_error("cannot read window frame " + std::to_string(frameIndex));
+        }
+
+        // The alignment path is chosen once per frame and used for all tiles
+        cv::Point shift;
+        GlobalMotion motion;
+        bool shifted = estimateShift(refFrame.getKeypoints(), *it, bestFeatures, shift);
+        bool rigid = !shifted && estimateGlobalMotion(refFrame.getKeypoints(), *it, bestFeatures, motion);
+        ++(shifted ? m_numShiftedFrames : rigid ? m_numGlobalMotionFrames : m_numMorphedFrames);
+
+        TaskGroup tileTasks;
+        for (int t = 0; t < tiles.size(); ++t)
+        {
+            std::vector<cv::Point2f>* frameKeypts = &(*it);
+            pool.submit(tileTasks, [this, &refFrame, &tmpFrame, frameKeypts, &bestFeatures, shifted, &shift, rigid, &motion, &tiles, t, margin, &tileSums]()
+            {
+                alignTile(refFrame, tmpFrame, *frameKeypts, bestFeatures, shifted ? &shift : 0, rigid ? &motion : 0, tiles[t], margin, tileSums[t]);
+            }, t);
+        }
+        pool.wait(tileTasks);
+
+        std::cout << "frame " << frameIndices[it - keypoints.begin()] << " succesfully warped by " << (shifted ? std::string("shift") : rigid ? "global " + m_params.motionModel : std::string("morphing")) << " (" << tiles.size() << " tiles)" << std::endl;
     }
 
-    std::cout << "feature based morphing done..." << std::endl;
+    printPathStats();
+
+}
+
+
+// Align a tile (in frame coordinates) of a frame straight into the tile sum
+// The tile only reads the source region it can sample from
+// @shift:  integer shift of the frame, 0 if the frame is warped
+// @motion: global motion of the frame, 0 if the frame gets morphed
+// @margin: maximum displacement of a morph lookup in pixels
+void VideoStabilizing::alignTile(VideoFrame& refFrame, cv::Mat& frame, std::vector<cv::Point2f>& keypoints, std::vector<int>& bestFeatures, const cv::Point* shift, const GlobalMotion* motion, const cv::Rect& tile, int margin, FrameAccumulator& tileSum) const
+{
+    cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+
+    // Source region the tile can sample from
+    cv::Rect srcRegion = cv::Rect(tile.x - margin, tile.y - margin, tile.width + 2 * margin, tile.height + 2 * margin) & frameRect;
+    if (shift)
+    {
+        // The shifted tile itself
+        srcRegion = (tile + *shift) & frameRect;
+        if (srcRegion.area() == 0)
+        {
+            srcRegion = cv::Rect(0, 0, 1, 1);
+        }
+    }
+    else if (motion)
+    {
+        // The global model is not bounded by the feature displacements, use the warped tile corners
+        std::vector<cv::Point2f> corners, warpedCorners;
+        corners.push_back(cv::Point2f(tile.x, tile.y));
+        corners.push_back(cv::Point2f(tile.x + tile.width, tile.y));
+        corners.push_back(cv::Point2f(tile.x, tile.y + tile.height));
+        corners.push_back(cv::Point2f(tile.x + tile.width, tile.y + tile.height));
+        cv::perspectiveTransform(corners, warpedCorners, motion->homography);
+
+        cv::Rect warpedTile = cv::boundingRect(warpedCorners);
+        srcRegion = cv::Rect(warpedTile.x - 2, warpedTile.y - 2, warpedTile.width + 4, warpedTile.height + 4) & frameRect;
+        if (srcRegion.area() == 0)
+        {
+            // Tile maps completely outside the frame, any region works: every tap lands in the zero border and the coverage is 0
+            srcRegion = cv::Rect(0, 0, 1, 1);
+        }
+    }
+
+    // Align tile to the reference frame (refFrame) straight into the tile sum
+    VideoFrame tileFrame(frame, srcRegion, m_params.compact);
+    tileFrame.setWeightKernel(m_params.weightKernel, m_powerExpKernel.get());
+    tileFrame.setFeatureWeights(refFrame.getFeatureWeights());
+    if (shift)
+    {
+        tileFrame.accumulateTileByShift(*shift, tile, tileSum);
+    }
+    else if (motion)
+    {
+        tileFrame.accumulateTileByGlobalMotion(motion->homography, tile, tileSum);
+    }
+    else
+    {
+        tileFrame.accumulateTileByFeatureBasedMorphing(refFrame.getKeypoints(), keypoints, bestFeatures, tile, tileSum);
+    }
+}
+
+
+// Read the frame with the given index
+// The window frames are read in frame order, only the reference frame between them gets skipped
+bool VideoStabilizing::readFrame(FrameSource& frameSource, int frameIndex, cv::Mat& frame)
+{
+    if (frameSource.position() > frameIndex)
+    {
+        frameSource.seek(frameIndex);
+    }
+
+    while (frameSource.position() < frameIndex)
+    {
+        if (!frameSource.read(frame))
+        {
+            return false;
+        }
+    }
+
+    return frameSource.read(frame);
+}
+
+
+// Tabulate the powexp weight kernel once per frame size instead of once per morphed frame or tile
+void VideoStabilizing::prepareWeightKernel(const cv::Size& frameSize)
+{
+    if (m_params.weightKernel == "powexp" && (!m_powerExpKernel || m_powerExpKernel->frameSize() != frameSize))
+    {
+        m_powerExpKernel.reset(new PowerExpKernel(frameSize));
+    }
+}
+
+
+// Add the aligned frame data to the sum of aligned frames
+// Compact frames are summed up in 32-bit integers, VideoProcessing::configure keeps them within FrameAccumulator::kMaxCompactFrames
+void VideoStabilizing::accumulate(VideoFrame& frame, const cv::Mat& displacement, FrameAccumulator& accumulator) const
+{
+    if (m_params.compact)
+    {
+        accumulator.add(frame.getAlignedFrameData16u(), displacement, frame.getValidity());
+    }
+    else
+    {
+        accumulator.add(frame.getAlignedFrameData32f(), displacement, frame.getValidity());
+    }
+}
+
+
+// Fit the global motion model to the correspondences of the best features with RANSAC
+// The fast path is taken if most features are inliers and the inliers fit within motionMaxResidual
+bool VideoStabilizing::estimateGlobalMotion(const std::vector<cv::Point2f>& refFrameKeypts, const std::vector<cv::Point2f>& keypoints, const std::vector<int>& bestFeatures, GlobalMotion& motion) const
+{
+    if (m_params.motionModel == "none")
+    {
+        return false;
+    }
+
+    std::vector<cv::Point2f> refPts, currPts;
+    for (int i = 0; i < bestFeatures.size(); ++i)
+    {
+        refPts.push_back(refFrameKeypts[bestFeatures[i]]);
+        currPts.push_back(keypoints[bestFeatures[i]]);
+    }
+
+    // A model needs more correspondences than its degrees of freedom to be verifiable
+    int minPts = (m_params.motionModel == "homography") ? 5 : (m_params.motionModel == "affine") ? 4 : 3;
+    if (refPts.size() < minPts)
+    {
+        return false;
+    }
+
+    // RANSAC inlier threshold in pixels
+    double ransacThreshold = std::max(1.0, 2.0 * m_params.motionMaxResidual);
+    std::vector<unsigned char> inliers;
+
+    if (m_params.motionModel == "homography")
+    {
+        motion.homography = cv::findHomography(refPts, currPts, cv::RANSAC, ransacThreshold, inliers);
+    }
+    else
+    {
+        cv::Mat affine = (m_params.motionModel == "affine") ? cv::estimateAffine2D(refPts, currPts, inliers, cv::RANSAC, ransacThreshold) : cv::estimateAffinePartial2D(refPts, currPts, inliers, cv::RANSAC, ransacThreshold);
+        if (!affine.empty())
+        {
+            motion.homography = cv::Mat::eye(3, 3, CV_64F);
+            affine.copyTo(motion.homography.rowRange(0, 2));
+        }
+    }
+
+    if (motion.homography.empty() || inliers.size() != refPts.size())
+    {
+        return false;
+    }
+
+    // RMS reprojection error of the inliers
+    std::vector<cv::Point2f> projPts;
+    cv::perspectiveTransform(refPts, projPts, motion.homography);
+
+    double squaredError = 0.0;
+    int numInliers = 0;
+    for (int i = 0; i < refPts.size(); ++i)
+    {
+        if (inliers[i])
+        {
+            cv::Point2f diff = projPts[i] - currPts[i];
+            squaredError += diff.x * diff.x + diff.y * diff.y;
+            ++numInliers;
+        }
+    }
+
+    motion.inlierRatio = (double) numInliers / refPts.size();
+    motion.residual = numInliers > 0 ? std::sqrt(squaredError / numInliers) : 0.0;
+
+    return numInliers > 0 && motion.inlierRatio >= m_params.motionMinInliers && motion.residual <= m_params.motionMaxResidual;
+}
+
+
+// Print how many frames took which alignment path
+void VideoStabilizing::printPathStats() const
+{
+    if (m_params.motionModel != "none" || m_params.staticThreshold > 0.0)
+    {
+        std::cout << "alignment paths: " << m_numShiftedFrames << " frames by integer shift, " << m_numGlobalMotionFrames << " frames by global " << m_params.motionModel << ", " << m_numMorphedFrames << " frames by morphing" << std::endl;
+    }
+}
+
+
+// Start counting the alignment paths of a new pass
+void VideoStabilizing::resetPathStats()
+{
+    m_numShiftedFrames = 0;
+    m_numGlobalMotionFrames = 0;
+    m_numMorphedFrames = 0;
+}
+
+
+// Near-identity check: the rounded mean displacement of the best features is the candidate shift,
+// it is taken if every feature displacement lies within staticThreshold of it
+// A morph lookup is a weighted mean of the feature displacements, so it is within staticThreshold of the shift as well
+bool VideoStabilizing::estimateShift(const std::vector<cv::Point2f>& refFrameKeypts, const std::vector<cv::Point2f>& keypoints, const std::vector<int>& bestFeatures, cv::Point& shift) const
+{
+    if (m_params.staticThreshold <= 0.0 || bestFeatures.empty())
+    {
+        return false;
+    }
+
+    cv::Point2f meanDisp(0.0f, 0.0f);
+    for (int i = 0; i < bestFeatures.size(); ++i)
+    {
+        meanDisp += keypoints[bestFeatures[i]] - refFrameKeypts[bestFeatures[i]];
+    }
+    meanDisp *= 1.0f / bestFeatures.size();
+    shift = cv::Point(cvRound(meanDisp.x), cvRound(meanDisp.y));
+
+    float maxSqDist = (float) (m_params.staticThreshold * m_params.staticThreshold);
+    for (int i = 0; i < bestFeatures.size(); ++i)
+    {
+        cv::Point2f diff = keypoints[bestFeatures[i]] - refFrameKeypts[bestFeatures[i]] - cv::Point2f(shift);
+        if (diff.x * diff.x + diff.y * diff.y > maxSqDist)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Maximum displacement of the best features over all frames
+// The morph lookup vector is a weighted mean of feature displacements and never exceeds this value
+float VideoStabilizing::maxDisplacement(const std::vector<cv::Point2f>& refFrameKeypts, const std::vector<std::vector<cv::Point2f> >& keypoints, const std::vector<int>& bestFeatures)
+{
+    float maxDisp = 0.0;
+
+    for (int f = 0; f < keypoints.size(); ++f)
+    {
+        for (int i = 0; i < bestFeatures.size(); ++i)
+        {
+            cv::Point2f disp = keypoints[f][bestFeatures[i]] - refFrameKeypts[bestFeatures[i]];
+            maxDisp = std::max(maxDisp, std::sqrt(disp.x * disp.x + disp.y * disp.y));
+        }
+    }
 
+    return maxDisp;
 }
@@ -10,6 +10,7 @@
 #define VIDEOSTAB_VIDEOSTABILIZING_HPP 
 
 // C++ std libraries
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -19,6 +20,32 @@
 
 // User libraries
 #include "VideoFrame.hpp"
+#include "FrameAccumulator.hpp"
+#include "FrameSource.hpp"
+#include "VideoProcessingParams.hpp"
+#include "ThreadPool.hpp"
+#include "VideoExporter.hpp"
+#include "WeightKernels.hpp"
+
+// Global motion model fitted to the feature correspondences of a frame
+struct GlobalMotion {
+    cv::Mat homography; // 3x3 model mapping reference frame to frame coordinates
+    double residual; // RMS reprojection error of the inliers in pixels
+    double inlierRatio; // fraction of RANSAC inliers
+};
+
+// Alignment of a frame to the reference frame, from cheapest to most expensive
+enum AlignmentPath {
+    kShiftPath, // near-identity: integer shift (or plain copy) of the frame
+    kGlobalMotionPath, // single warp by the global motion model
+    kMorphPath // feature based morphing
+};
+
+// Aligned frame whose addition to the sum is deferred, e.g. to add it together with the sub-frames following it
+struct AlignedFrame {
+    VideoFrame frame; // aligned frame data and its validity
+    cv::Mat displacement; // magnitude of the lookup displacements, empty without motion statistics
+};
 
 class VideoStabilizing 
 {
@@ -26,10 +53,88 @@ class VideoStabilizing
     public:
         
         // Constructors
-        VideoStabilizing();
+        // Frames are aligned on the given pool, or on an own pool of params.warpThreads workers
+        VideoStabilizing(const VideoProcessingParams&, ThreadPool* = 0);
+
+        // Hand every aligned frame and the reference frame of stabilizeUsingMorphing to the exporter, the reference frame has the given position in the clip
+        // Aligned frames are stored then, even without debug frames
+        void setExporter(VideoExporter*, int);
+
+        // Feature based morphing, throws std::runtime_error if a window frame cannot be read
+        void stabilizeUsingMorphing(VideoFrame&, FrameSource&, const std::vector<int>&, std::vector<std::vector<cv::Point2f> >&, std::vector<int>&, FrameAccumulator&);
+
+        // Feature based morphing of a set of tiles, each tile only reads the source region it samples from
+        // Throws std::runtime_error if a window frame cannot be read
+        void stabilizeTilesUsingMorphing(VideoFrame&, FrameSource&, const std::vector<int>&, std::vector<std::vector<cv::Point2f> >&, std::vector<int>&, const std::vector<cv::Rect>&, int, std::vector<FrameAccumulator>&);
+
+        // Maximum displacement of the best features with respect to the reference frame
+        static float maxDisplacement(const std::vector<cv::Point2f>&, const std::vector<std::vector<cv::Point2f> >&, const std::vector<int>&);
+
+        // Fit the global motion model to the best features, return true if it explains the motion of the frame
+        bool estimateGlobalMotion(const std::vector<cv::Point2f>&, const std::vector<cv::Point2f>&, const std::vector<int>&, GlobalMotion&) const;
+
+        // Return true if all best features moved by the same integer shift within params.staticThreshold
+        bool estimateShift(const std::vector<cv::Point2f>&, const std::vector<cv::Point2f>&, const std::vector<int>&, cv::Point&) const;
+
+    private:
+
+        // Read the frame with the given index, frames in between (the reference frame) are skipped
+        static bool readFrame(FrameSource&, int, cv::Mat&);
+
+        // Tabulate the powexp weight kernel for the frame size, before the frames are aligned
+        void prepareWeightKernel(const cv::Size&);
+
+        // Align a frame to the reference frame and add it to the accumulator, return the alignment path it took
+        // The aligned frame is returned in 8 bits if an output is given, with a deferred frame given it is handed back instead of added
+        AlignmentPath alignAndAccumulate(VideoFrame&, cv::Mat&, int, std::vector<cv::Point2f>&, std::vector<int>&, FrameAccumulator&, cv::Mat*, AlignedFrame* = 0) const;
+
+        // Add an aligned frame and the given number of sub-frames towards the next window frame (keypoints of both frames) to the accumulator
+        void accumulateWithSubFrames(VideoFrame&, AlignedFrame&, const std::vector<cv::Point2f>&, const std::vector<cv::Point2f>&, const std::vector<int>&, int, FrameAccumulator&) const;
+
+        // Number of sub-frames after a window frame (index, number of window frames)
+        int numSubFrames(int, int) const;
+
+        // Align a tile of a frame into its tile sum, by the shift or the global motion if given and by morphing otherwise
+        void alignTile(VideoFrame&, cv::Mat&, std::vector<cv::Point2f>&, std::vector<int>&, const cv::Point*, const GlobalMotion*, const cv::Rect&, int, FrameAccumulator&) const;
+
+        // Add the aligned frame data and its lookup displacements to the sum of aligned frames
+        void accumulate(VideoFrame&, const cv::Mat&, FrameAccumulator&) const;
+
+        // Print how many frames took which alignment path
+        void printPathStats() const;
+
+        // Start counting the alignment paths of a new pass over the window frames
+        void resetPathStats();
+
+        // Pool aligning the frames
+        ThreadPool& workerPool();
+
+        // Processing parameters
+        VideoProcessingParams m_params;
+
+        // Number of frames aligned by an integer shift
+        int m_numShiftedFrames;
+
+        // Number of frames aligned by the global motion model
+        int m_numGlobalMotionFrames;
+
+        // Number of frames aligned by feature based morphing
+        int m_numMorphedFrames;
+
+        // Shared pool, null if the own pool is used
+        ThreadPool* m_pool;
+
+        // Own pool, started on first use
+        std::unique_ptr<ThreadPool> m_ownPool;
+
+        // Encoder of the stabilized clip, null if not exported
+        VideoExporter* m_exporter;
+
+        // Position of the reference frame in the exported clip
+        int m_refPosition;
 
-        // Feature based morphing
-        void stabilizeUsingMorphing(VideoFrame&, cv::VideoCapture&, int, std::vector<std::vector<cv::Point2f> >&, std::vector<int>&, cv::Mat&);
+        // Table of the powexp weight kernel shared by all aligned frames, null before the first frame size is known
+        std::unique_ptr<PowerExpKernel> m_powerExpKernel;
 
 };
 
@@ -0,0 +1,177 @@
+/**************************************
+ * Header file: WeightKernels.hpp
+ *
+ * Weight kernels of the feature based
+ * morphing, used as template policies
+ *
+ * A kernel is constructed from the
+ * frame size and returns the weight of
+ * a feature at distance r (pixels),
+ * always > 0
+ *
+ * ***********************************/
+
+#ifndef VIDEOSTAB_WEIGHTKERNELS_HPP
+#define VIDEOSTAB_WEIGHTKERNELS_HPP
+
+// C++ std libraries
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+// OpenCV libraries
+#include <opencv2/core/core.hpp>
+
+// Original kernel: pow(0.9, 100r/rMax) + 10 exp(-0.1/rMax r^2) + 1
+// The second term depends on the frame size, so the kernel is tabulated per frame size
+// and linearly interpolated between the N sample points
+// The table is built once per frame size and shared by all frames, see VideoFrame::setWeightKernel
+class PowerExpKernel
+{
+
+    public:
+
+        // Number of sample points of the table
+        static const int N = 500;
+
+        // Tabulate the kernel over [0..frame diagonal]
+        explicit PowerExpKernel(const cv::Size& frameSize) : m_frameSize(frameSize)
+        {
+            float rMax = std::max(frameSize.width, frameSize.height);
+            float maxDist = std::sqrt((float) frameSize.width * frameSize.width + (float) frameSize.height * frameSize.height);
+            m_step = maxDist / N;
+            m_invStep = 1.0f / m_step;
+
+            // One guard entry past the diagonal, so the right neighbour of the last sample exists
+            for (int i = 0; i <= N; ++i)
+            {
+                m_table[i] = evaluate(i * m_step, rMax);
+            }
+        }
+
+        // Closed form of the kernel
+        static float evaluate(float r, float rMax)
+        {
+            return std::pow(0.9f, (100 * r) / rMax) + 10 * std::exp(-0.1f / rMax * r * r) + 1;
+        }
+
+        // Linearly interpolated weight
+        float operator()(float r) const
+        {
+            float pos = r * m_invStep;
+            int idx = std::min((int) pos, N - 1);
+            float t = pos - idx;
+            return (1.0f - t) * m_table[idx] + t * m_table[idx + 1];
+        }
+
+        // Frame size the kernel is tabulated for
+        cv::Size frameSize() const
+        {
+            return m_frameSize;
+        }
+
+    private:
+
+        // Frame size the kernel is tabulated for
+        cv::Size m_frameSize;
+
+        // Kernel samples, N + 1 entries
+        float m_table[N + 1];
+
+        // Step width of the sample points
+        float m_step;
+
+        // Inverse step width
+        float m_invStep;
+};
+
+
+// Gaussian kernel exp(-r^2 / (2 sigma^2)), sigma = rMax / 4
+// A constant floor keeps distant pixels at the mean feature motion instead of dividing by zero
+class GaussianKernel
+{
+
+    public:
+
+        // Kernel width from the frame size
+        explicit GaussianKernel(const cv::Size& frameSize)
+        {
+            float sigma = 0.25f * std::max(frameSize.width, frameSize.height);
+            m_invTwoSigmaSq = 1.0f / (2.0f * sigma * sigma);
+        }
+
+        // Weight of a feature at distance r
+        float operator()(float r) const
+        {
+            return std::exp(-r * r * m_invTwoSigmaSq) + 1e-6f;
+        }
+
+    private:
+
+        // 1 / (2 sigma^2)
+        float m_invTwoSigmaSq;
+};
+
+
+// Inverse distance (Shepard) kernel 1 / (1 + (r / r0)^2), r0 = rMax / 100
+// Pixels on a feature move (nearly) exactly like it
+class InverseDistanceKernel
+{
+
+    public:
+
+        // Kernel radius from the frame size
+        explicit InverseDistanceKernel(const cv::Size& frameSize)
+        {
+            float r0 = 0.01f * std::max(frameSize.width, frameSize.height);
+            m_invR0Sq = 1.0f / (r0 * r0);
+        }
+
+        // Weight of a feature at distance r
+        float operator()(float r) const
+        {
+            return 1.0f / (1.0f + r * r * m_invR0Sq);
+        }
+
+    private:
+
+        // 1 / r0^2
+        float m_invR0Sq;
+};
+
+
+// Wendland C2 kernel (1 - q)^4 (4q + 1), q = r / h, compact support h = rMax / 2
+// Features beyond the support only contribute through a small floor
+class WendlandKernel
+{
+
+    public:
+
+        // Support radius from the frame size
+        explicit WendlandKernel(const cv::Size& frameSize)
+        {
+            m_invSupport = 1.0f / (0.5f * std::max(frameSize.width, frameSize.height));
+        }
+
+        // Weight of a feature at distance r
+        float operator()(float r) const
+        {
+            float q = std::min(r * m_invSupport, 1.0f);
+            float s = 1.0f - q;
+            return s * s * s * s * (4.0f * q + 1.0f) + 1e-6f;
+        }
+
+    private:
+
+        // 1 / h
+        float m_invSupport;
+};
+
+
+// Return true if name is one of the weight kernels: powexp, gaussian, idw, wendland
+inline bool isWeightKernel(const std::string& name)
+{
+    return name == "powexp" || name == "gaussian" || name == "idw" || name == "wendland";
+}
+
+#endif // VIDEOSTAB_WEIGHTKERNELS_HPP
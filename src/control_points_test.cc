@@ -0,0 +1,184 @@
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "FeatureTracking.hpp"
+#include "VideoFrame.hpp"
+
+namespace {
+
+// Frame size of the synthetic tracks
+const cv::Size kFrameSize(640, 480);
+
+// Number of window frames of the synthetic tracks
+const int kNumFrames = 6;
+
+// Tolerance of merged positions, the control points average in float
+const float kPositionTolerance = 1e-3f;
+
+int numFailures = 0;
+
+void expect(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cout << "FAILED " << what << std::endl;
+        ++numFailures;
+    }
+}
+
+// Synthetic tracks: reference keypoints and keypoints in every window frame, by track index
+struct Tracks {
+    std::vector<cv::Point2f> refKeypts;
+    std::vector<std::vector<cv::Point2f> > keypoints;
+    std::vector<int> bestFeatures;
+};
+
+// Deterministic jitter in [-amplitude, amplitude]
+float jitter(int i, int f, float amplitude) {
+    return amplitude * std::sin(12.9898f * i + 78.233f * f);
+}
+
+// Add a cluster of tracks within 2 pixels of the center that move together, up to the jitter
+void addCluster(Tracks& tracks, cv::Point2f center, cv::Point2f velocity, int size, float jitterAmplitude, bool best) {
+    for (int n = 0; n < size; ++n) {
+        int t = tracks.refKeypts.size();
+        cv::Point2f refPos = center + cv::Point2f(std::cos(n * 2.4f), std::sin(n * 2.4f)) * (2.0f * n / size);
+        tracks.refKeypts.push_back(refPos);
+        for (int f = 0; f < kNumFrames; ++f) {
+            tracks.keypoints[f].push_back(refPos + velocity * (f + 1.0f) + cv::Point2f(jitter(t, f, jitterAmplitude), jitter(t + 7, f, jitterAmplitude)));
+        }
+        if (best) {
+            tracks.bestFeatures.push_back(t);
+        }
+    }
+}
+
+// Run the clustering on the tracks, returns the number of control points and the reference frame holding their weights
+int cluster(const Tracks& tracks, int maxPoints, float motionTolerance, VideoFrame& refFrame, std::vector<std::vector<cv::Point2f> >& keypoints, std::vector<int>& bestFeatures) {
+    cv::Mat frame = cv::Mat::zeros(kFrameSize, CV_8UC3);
+    refFrame = VideoFrame(frame);
+    refFrame.getKeypoints() = tracks.refKeypts;
+    keypoints = tracks.keypoints;
+    bestFeatures = tracks.bestFeatures;
+    return FeatureTracking::clusterControlPoints(refFrame, keypoints, bestFeatures, maxPoints, motionTolerance);
+}
+
+// Properties every clustering has: at most maxPoints points, the control points replace the tracks,
+// the weights count the merged best features and the weighted control points keep the sum of the merged tracks
+void checkInvariants(const std::string& name, const Tracks& tracks, int maxPoints, int numPoints, VideoFrame& refFrame, const std::vector<std::vector<cv::Point2f> >& keypoints, const std::vector<int>& bestFeatures) {
+    expect(numPoints <= maxPoints, name + ": at most " + std::to_string(maxPoints) + " control points, got " + std::to_string(numPoints));
+    expect(refFrame.getKeypoints().size() == numPoints && bestFeatures.size() == numPoints, name + ": keypoints and best features replaced by the control points");
+    for (int c = 0; c < bestFeatures.size(); ++c) {
+        expect(bestFeatures[c] == c, name + ": best feature " + std::to_string(c) + " is control point " + std::to_string(c));
+    }
+
+    const std::vector<float>& weights = refFrame.getFeatureWeights();
+    expect(weights.size() == numPoints, name + ": one weight per control point");
+    float weightSum = 0.0f;
+    for (int c = 0; c < weights.size(); ++c) {
+        expect(weights[c] >= 1.0f && weights[c] == std::floor(weights[c]), name + ": weight of control point " + std::to_string(c) + " counts merged tracks");
+        weightSum += weights[c];
+    }
+    expect(weightSum == tracks.bestFeatures.size(), name + ": weights sum up to the number of best features");
+
+    // Every control point is the mean of its tracks, so the weighted control points sum up to the tracks
+    for (int f = -1; f < kNumFrames; ++f) {
+        const std::vector<cv::Point2f>& merged = (f < 0) ? refFrame.getKeypoints() : keypoints[f];
+        const std::vector<cv::Point2f>& original = (f < 0) ? tracks.refKeypts : tracks.keypoints[f];
+        expect(merged.size() == numPoints, name + ": window keypoints replaced in frame " + std::to_string(f));
+        cv::Point2f weightedSum(0.0f, 0.0f), trackSum(0.0f, 0.0f);
+        for (int c = 0; c < merged.size() && c < weights.size(); ++c) {
+            weightedSum += merged[c] * weights[c];
+        }
+        for (int i = 0; i < tracks.bestFeatures.size(); ++i) {
+            trackSum += original[tracks.bestFeatures[i]];
+        }
+        expect(cv::norm(weightedSum - trackSum) <= kPositionTolerance * tracks.bestFeatures.size(), name + ": weighted control points keep the sum of the tracks in frame " + std::to_string(f));
+    }
+}
+
+}  // namespace
+
+// Control points of synthetic tracks: bounded number of points, merged positions are the mean of the merged tracks,
+// weights are the number of merged tracks
+int main (int argc, char** argv) {
+    // Well separated clusters of consistent motion, each one becomes a single control point
+    Tracks clusters;
+    clusters.keypoints.resize(kNumFrames);
+    std::vector<cv::Point2f> centers;
+    std::vector<int> sizes;
+    for (int g = 0; g < 6; ++g) {
+        cv::Point2f center(80.0f + 240.0f * (g % 3), 100.0f + 280.0f * (g / 3));
+        centers.push_back(center);
+        sizes.push_back(3 + 2 * g);
+        addCluster(clusters, center, cv::Point2f(1.5f - 0.5f * g, 0.25f * g), sizes.back(), 0.2f, true);
+
+        // Tracks that are no best features never join a control point
+        addCluster(clusters, center + cv::Point2f(4.0f, 4.0f), cv::Point2f(-20.0f, 20.0f), 2, 0.0f, false);
+    }
+
+    VideoFrame refFrame;
+    std::vector<std::vector<cv::Point2f> > keypoints;
+    std::vector<int> bestFeatures;
+    int numPoints = cluster(clusters, 6, 1.0f, refFrame, keypoints, bestFeatures);
+    checkInvariants("clusters", clusters, 6, numPoints, refFrame, keypoints, bestFeatures);
+    expect(numPoints == 6, "clusters: one control point per cluster, got " + std::to_string(numPoints));
+
+    // Every control point is the mean track of exactly one cluster, weighted by its size
+    int numMembers = 0;
+    for (int g = 0; g < centers.size() && numPoints == 6; ++g) {
+        std::vector<int> members;
+        for (int i = 0; i < clusters.bestFeatures.size(); ++i) {
+            if (cv::norm(clusters.refKeypts[clusters.bestFeatures[i]] - centers[g]) <= 3.0f) {
+                members.push_back(clusters.bestFeatures[i]);
+            }
+        }
+        cv::Point2f refMean(0.0f, 0.0f);
+        for (int m = 0; m < members.size(); ++m) {
+            refMean += clusters.refKeypts[members[m]] * (1.0f / members.size());
+        }
+
+        int c = 0;
+        for (int p = 1; p < numPoints; ++p) {
+            if (cv::norm(refFrame.getKeypoints()[p] - refMean) < cv::norm(refFrame.getKeypoints()[c] - refMean)) {
+                c = p;
+            }
+        }
+        std::string name = "cluster " + std::to_string(g);
+        expect(cv::norm(refFrame.getKeypoints()[c] - refMean) <= kPositionTolerance, name + ": reference position is the mean of its tracks");
+        expect(refFrame.getFeatureWeights()[c] == sizes[g], name + ": weight " + std::to_string(refFrame.getFeatureWeights()[c]) + ", expected " + std::to_string(sizes[g]));
+        for (int f = 0; f < kNumFrames; ++f) {
+            cv::Point2f mean(0.0f, 0.0f);
+            for (int m = 0; m < members.size(); ++m) {
+                mean += clusters.keypoints[f][members[m]] * (1.0f / members.size());
+            }
+            expect(cv::norm(keypoints[f][c] - mean) <= kPositionTolerance, name + ": position in frame " + std::to_string(f) + " is the mean of its tracks");
+        }
+        numMembers += members.size();
+    }
+    expect(numMembers == clusters.bestFeatures.size() || numPoints != 6, "clusters: every best feature belongs to a cluster");
+
+    // Scattered tracks with inconsistent motion: radius and tolerance grow until the bound holds
+    Tracks scattered;
+    scattered.keypoints.resize(kNumFrames);
+    for (int i = 0; i < 200; ++i) {
+        cv::Point2f center(5.0f + (i * 37) % 630, 5.0f + (i * 53) % 470);
+        addCluster(scattered, center, cv::Point2f(jitter(i, 0, 3.0f), jitter(i, 1, 3.0f)), 1, 2.0f, true);
+    }
+    for (int maxPoints = 1; maxPoints <= 64; maxPoints *= 4) {
+        numPoints = cluster(scattered, maxPoints, 0.5f, refFrame, keypoints, bestFeatures);
+        checkInvariants("scattered, " + std::to_string(maxPoints) + " points", scattered, maxPoints, numPoints, refFrame, keypoints, bestFeatures);
+    }
+
+    // Fewer tracks than control points: the tracks are kept as they are
+    Tracks few;
+    few.keypoints.resize(kNumFrames);
+    addCluster(few, cv::Point2f(320.0f, 240.0f), cv::Point2f(1.0f, 0.0f), 4, 0.0f, true);
+    numPoints = cluster(few, 8, 1.0f, refFrame, keypoints, bestFeatures);
+    expect(numPoints == 4 && bestFeatures == few.bestFeatures && keypoints == few.keypoints, "few tracks: kept unchanged");
+
+    std::cout << (numFailures == 0 ? "control points passed" : "control points FAILED") << std::endl;
+    return numFailures == 0 ? 0 : 1;
+}
@@ -1,28 +1,53 @@
 #include "file_utils.h"
 
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstdlib>
 #include <iostream>
 
 namespace base {
 
 bool FileUtils::IsDir(const std::string& dir) {
-    return (dir.find(".") == std::string::npos);
+    struct stat info;
+    return stat(dir.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+bool FileUtils::CreateDirRecursively(const std::string& path,
+                                     const std::string& delimiter) {
+    const mode_t mode = 0777;
+    size_t pos = 0;
+    while (pos != std::string::npos) {
+        pos = path.find(delimiter, pos + 1);
+        const std::string sub_dir = path.substr(0, pos);
+        if (sub_dir.empty() || IsDir(sub_dir)) continue;
+        if (mkdir(sub_dir.c_str(), mode) == 0) {
+            std::cout << "new directory created: " << sub_dir << std::endl;
+        } else if (errno != EEXIST) {
+            std::cout << "could not create directory: " << sub_dir << std::endl;
+            return false;
+        }
+    }
+    return true;
 }
 
 bool FileUtils::CreateDirRecursivelyOrDie(const std::string& path,
                                           const std::string& delimiter) {
-    if (!IsDir(path)) return false;
-
-    std::string dir = path;
-    size_t pos = 0;
-    std::string root_dir = "";
-    while ((pos = path.find(delimiter)) != std::string::npos) {
-        const std::string sub_dir = dir.substr(0, pos);
-        std::cout << "sub dir: " << sub_dir << std::endl;
-        root_dir = root_dir + delimiter + sub_dir,
-        std::cout << "root dir: " << root_dir << std::endl;
-        dir.erase(0, pos + delimiter.length());
+    if (!CreateDirRecursively(path, delimiter)) {
+        std::exit(EXIT_FAILURE);
     }
-    return false;
+    return true;
+}
+
+std::string FileUtils::BaseName(const std::string& path,
+                                const std::string& delimiter) {
+    const size_t slash = path.rfind(delimiter);
+    std::string name =
+        (slash == std::string::npos) ? path : path.substr(slash + delimiter.size());
+    const size_t dot = name.rfind(".");
+    if (dot != std::string::npos && dot > 0) name = name.substr(0, dot);
+    return name;
 }
 
 }  // namespace base
@@ -7,11 +7,20 @@
 namespace base {
 
 class FileUtils {
+ public:
+  static bool IsDir(const std::string& dir);
 
-static bool IsDir(const std::string& dir);
-static bool CreateDirRecursivelyOrDie(const std::string& dir,
-                                      const std::string& delimiter = "/");
+  // Creates all missing directories of the path, returns false on failure.
+  static bool CreateDirRecursively(const std::string& dir,
+                                   const std::string& delimiter = "/");
 
+  // Same as CreateDirRecursively but exits the process on failure.
+  static bool CreateDirRecursivelyOrDie(const std::string& dir,
+                                        const std::string& delimiter = "/");
+
+  // Returns the last component of a path without its file extension.
+  static std::string BaseName(const std::string& path,
+                              const std::string& delimiter = "/");
 };
 
 }  // namespace base
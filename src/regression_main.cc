@@ -0,0 +1,49 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "RegressionRunner.hpp"
+
+int main (int argc, char** argv) {
+    // Options are of the form --key=value
+    // --golden=DIR directory of the golden images and timing baselines (required)
+    // --update rewrite the golden files from this run
+    // --min_psnr=DB, --min_ssim=S pass criteria
+    // --gate_timings fail on a stage slower than --timing_margin=F and --timing_slack=SECONDS allow, otherwise timings are only reported
+    // all other options are pipeline options applied to every case
+    VideoProcessingParams params;
+    params.numFrames = 12;
+    params.debugFrames = false;
+
+    RegressionThresholds thresholds;
+    std::string goldenDir;
+    bool update = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--golden=") == 0) {
+            goldenDir = arg.substr(9);
+        } else if (arg == "--update") {
+            update = true;
+        } else if (arg.compare(0, 11, "--min_psnr=") == 0) {
+            thresholds.minPsnr = std::atof(arg.substr(11).c_str());
+        } else if (arg.compare(0, 11, "--min_ssim=") == 0) {
+            thresholds.minSsim = std::atof(arg.substr(11).c_str());
+        } else if (arg == "--gate_timings") {
+            thresholds.gateTimings = true;
+        } else if (arg.compare(0, 16, "--timing_margin=") == 0) {
+            thresholds.timingMargin = std::atof(arg.substr(16).c_str());
+        } else if (arg.compare(0, 15, "--timing_slack=") == 0) {
+            thresholds.timingSlack = std::atof(arg.substr(15).c_str());
+        } else if (!parseVideoProcessingParam(arg, params)) {
+            return 1;
+        }
+    }
+
+    if (goldenDir.empty()) {
+        std::cout << "usage: " << argv[0] << " --golden=DIR [--update] [options]" << std::endl;
+        return 1;
+    }
+
+    RegressionRunner regressionRunner(params, goldenDir, thresholds);
+    return regressionRunner.run(update) == 0 ? 0 : 1;
+}
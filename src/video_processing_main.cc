@@ -1,6 +1,9 @@
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
 
+#include "BatchRunner.hpp"
+#include "MemoryStats.hpp"
 #include "VideoProcessing.hpp"
 
 int main (int argc, char** argv) {
@@ -8,8 +11,37 @@ int main (int argc, char** argv) {
     std::string fileName;
     std::string fileType;
 
-    if (argc > 1) {
-        file = argv[1];
+    // Options are of the form --key=value, the first other argument is the video file
+    // --batch=<manifest> processes all clips of the manifest, --jobs=N of them concurrently
+    VideoProcessingParams params;
+    std::string manifest;
+    int numJobs = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 8, "--batch=") == 0) {
+            manifest = arg.substr(8);
+        } else if (arg.compare(0, 7, "--jobs=") == 0) {
+            numJobs = std::atoi(arg.substr(7).c_str());
+        } else if (arg.compare(0, 2, "--") == 0) {
+            if (!parseVideoProcessingParam(arg, params)) {
+                return 1;
+            }
+        } else {
+            file = arg;
+        }
+    }
+
+    // Allocations of all jobs are counted from here on, the summary is printed at exit
+    if (params.memoryStats) {
+        MemoryStats::instance().enable();
+    }
+
+    if (!manifest.empty()) {
+        BatchRunner batchRunner(params, numJobs);
+        return batchRunner.run(manifest) == 0 ? 0 : 1;
+    }
+
+    if (!file.empty()) {
         fileName = file.substr(0, file.size() - 4);
         fileType = file.substr(file.size() - 4, file.size());
 
@@ -20,7 +52,8 @@ int main (int argc, char** argv) {
         fileType = ".avi";
     }
 
-    VideoProcessing VidProc(fileName + fileType, fileName);
+    VideoProcessing session(params);
+    session.process(fileName + fileType, fileName);
 
     return 0;
 }
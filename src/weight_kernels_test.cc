@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "WeightKernels.hpp"
+
+namespace {
+
+// Frame size the kernels are built for, the diagonal is 800 pixels
+const cv::Size kFrameSize(640, 480);
+
+// Number of kernel evaluations of the bench
+const int kBenchEvaluations = 1 << 22;
+
+int numFailures = 0;
+
+// Compare a kernel weight with its closed form
+void expectNear(const std::string& kernel, double r, double weight, double expected, double relTol) {
+    double error = std::abs(weight - expected);
+    if (!(error <= relTol * std::abs(expected)) || !(weight > 0.0)) {
+        std::cout << "FAILED " << kernel << " at r = " << r << ": " << weight << ", expected " << expected << std::endl;
+        ++numFailures;
+    }
+}
+
+// Distances from the feature itself to the frame diagonal
+std::vector<double> sampleDistances() {
+    std::vector<double> distances;
+    double diagonal = std::sqrt((double) kFrameSize.width * kFrameSize.width + (double) kFrameSize.height * kFrameSize.height);
+    for (int i = 0; i <= 400; ++i) {
+        distances.push_back(diagonal * i / 400.0);
+    }
+    distances.push_back(0.3);
+    distances.push_back(7.77);
+    distances.push_back(123.456);
+    return distances;
+}
+
+// Check a kernel against its closed form at all sample distances
+template<typename Kernel, typename ClosedForm>
+void checkKernel(const std::string& name, const Kernel& kernel, ClosedForm closedForm, double relTol) {
+    std::vector<double> distances = sampleDistances();
+    for (int i = 0; i < distances.size(); ++i) {
+        expectNear(name, distances[i], kernel(distances[i]), closedForm(distances[i]), relTol);
+    }
+}
+
+// Time the kernel over the distances of a sweep across the frame, like the inner loop of the morph
+// The sum is printed, so the evaluations cannot be optimized away
+template<typename Kernel>
+void benchKernel(const std::string& name, const Kernel& kernel) {
+    float maxDist = std::sqrt((float) kFrameSize.width * kFrameSize.width + (float) kFrameSize.height * kFrameSize.height);
+    float step = maxDist / kBenchEvaluations;
+    float sum = 0.0f;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kBenchEvaluations; ++i) {
+        sum += kernel(i * step);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "bench " << name << ": " << 1e9 * seconds / kBenchEvaluations << " ns per weight (sum " << sum << ")" << std::endl;
+}
+
+}  // namespace
+
+// Every weight kernel policy against its closed form, the table guard entry of PowerExpKernel and a bench of each policy
+int main (int argc, char** argv) {
+    double rMax = std::max(kFrameSize.width, kFrameSize.height);
+
+    // Tabulated kernel: linear interpolation between 500 samples over the diagonal
+    PowerExpKernel powExp(kFrameSize);
+    checkKernel("powexp", powExp, [rMax](double r) {
+        return std::pow(0.9, 100.0 * r / rMax) + 10.0 * std::exp(-0.1 / rMax * r * r) + 1.0;
+    }, 1e-3);
+
+    // The guard entry: at the diagonal the right neighbour of the last sample is read with full weight
+    double diagonal = std::sqrt((double) kFrameSize.width * kFrameSize.width + (double) kFrameSize.height * kFrameSize.height);
+    expectNear("powexp guard", diagonal, powExp(diagonal), PowerExpKernel::evaluate(diagonal, rMax), 1e-4);
+    expectNear("powexp table", 0.0, powExp(0.0f), PowerExpKernel::evaluate(0.0f, rMax), 1e-6);
+
+    GaussianKernel gaussian(kFrameSize);
+    checkKernel("gaussian", gaussian, [rMax](double r) {
+        double sigma = 0.25 * rMax;
+        return std::exp(-r * r / (2.0 * sigma * sigma)) + 1e-6;
+    }, 1e-4);
+
+    InverseDistanceKernel idw(kFrameSize);
+    checkKernel("idw", idw, [rMax](double r) {
+        double r0 = 0.01 * rMax;
+        return 1.0 / (1.0 + (r / r0) * (r / r0));
+    }, 1e-4);
+
+    WendlandKernel wendland(kFrameSize);
+    checkKernel("wendland", wendland, [rMax](double r) {
+        double q = std::min(r / (0.5 * rMax), 1.0);
+        return std::pow(1.0 - q, 4) * (4.0 * q + 1.0) + 1e-6;
+    }, 1e-3);
+
+    benchKernel("powexp", powExp);
+    benchKernel("gaussian", gaussian);
+    benchKernel("idw", idw);
+    benchKernel("wendland", wendland);
+
+    std::cout << (numFailures == 0 ? "weight kernels passed" : "weight kernels FAILED") << std::endl;
+    return numFailures == 0 ? 0 : 1;
+}